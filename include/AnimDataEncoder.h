@@ -0,0 +1,50 @@
+#ifndef ANIMDATAENCODER_H
+#define ANIMDATAENCODER_H
+
+#include <Arduino.h>
+#include <memory>
+
+// Builds the complete custom effect body ({"write": {... "animData": "..."}}) for setStaticColors.
+// The buffer is sized for the layout and only grows, so no heap is touched per message once the
+// first palette for a layout was encoded.
+class AnimDataEncoder
+{
+public:
+    static const size_t MAX_TILE_ID_LENGTH = 5; // Panel ids are 16 bit
+    // Longest entry: " <id> 2 <r> <g> <b> 0 3600 0 0 0 0 360"
+    static const size_t MAX_ENTRY_LENGTH = 1 + MAX_TILE_ID_LENGTH + 3 + 11 + 19;
+    static const size_t FRAME_LENGTH = 128; // Head, tile count and tail of the body
+
+    // Starts a new body with room for maxEntries tiles and triangles. False if that much memory
+    // is not available
+    bool begin(size_t maxEntries);
+
+    // Fades the tile in to the given color
+    bool addTile(uint16_t tileId, uint8_t r, uint8_t g, uint8_t b);
+
+    // Shows the color on a triangle and fades it out again
+    bool addTriangle(uint16_t tileId, uint8_t r, uint8_t g, uint8_t b);
+
+    // Writes the tile count and the closing part of the body
+    bool finish();
+
+    const char *data() const;
+
+    size_t length() const;
+
+    size_t tileCount() const;
+
+private:
+    void beginEntry(uint16_t tileId);
+    void append(const char *text, size_t length);
+    void appendUInt(uint32_t value);
+
+    std::unique_ptr<char[]> buffer;
+    size_t capacity = 0;
+    size_t position = 0;
+    size_t countPosition = 0;
+    size_t tiles = 0;
+    bool overflow = false;
+};
+
+#endif // ANIMDATAENCODER_H
@@ -0,0 +1,174 @@
+#ifndef BLOBCACHE_H
+#define BLOBCACHE_H
+
+#include <Arduino.h>
+
+// Least recently used cache of variable length byte strings in a fixed pool. Entries are kept
+// back to back, removing one closes the gap by moving the bytes behind it, so the free space is
+// always a single block at the end and nothing is allocated at runtime.
+// Slots are stable: an entry keeps its slot until it is removed.
+template <size_t POOL_SIZE, size_t MAX_ENTRIES>
+class BlobCache
+{
+public:
+    static const int NONE = -1;
+
+    // Slot of the entry, NONE if it is not cached
+    int find(const uint32_t key) const
+    {
+        for (size_t i = 0; i < MAX_ENTRIES; i++)
+        {
+            if (slots[i].used && slots[i].key == key)
+            {
+                return i;
+            }
+        }
+        return NONE;
+    }
+
+    // Marks the entry as the most recently used one
+    void touch(const int slot)
+    {
+        slots[slot].lastUsed = ++useCounter;
+    }
+
+    // Stores a copy, replacing an entry with the same key and evicting the least recently used
+    // ones until it fits. Returns the slot, NONE if it is larger than the whole pool
+    int put(const uint32_t key, const uint8_t *data, const size_t length)
+    {
+        if (length > POOL_SIZE)
+        {
+            return NONE;
+        }
+        const int existing = find(key);
+        if (existing != NONE)
+        {
+            remove(existing);
+        }
+
+        int slot;
+        while (used + length > POOL_SIZE || (slot = freeSlot()) == NONE)
+        {
+            remove(leastRecentlyUsed());
+            evictions++;
+        }
+
+        slots[slot] = {key, used, length, ++useCounter, true};
+        memcpy(pool + used, data, length);
+        used += length;
+        return slot;
+    }
+
+    void remove(const int slot)
+    {
+        Slot &removed = slots[slot];
+        const size_t end = removed.offset + removed.length;
+        memmove(pool + removed.offset, pool + end, used - end);
+        for (Slot &other : slots)
+        {
+            if (other.used && other.offset > removed.offset)
+            {
+                other.offset -= removed.length;
+            }
+        }
+        used -= removed.length;
+        removed.used = false;
+    }
+
+    void clear()
+    {
+        for (Slot &slot : slots)
+        {
+            slot.used = false;
+        }
+        used = 0;
+    }
+
+    bool isUsed(const int slot) const
+    {
+        return slots[slot].used;
+    }
+
+    uint32_t getKey(const int slot) const
+    {
+        return slots[slot].key;
+    }
+
+    // Valid until the next put() or remove()
+    const uint8_t *getData(const int slot) const
+    {
+        return pool + slots[slot].offset;
+    }
+
+    size_t getLength(const int slot) const
+    {
+        return slots[slot].length;
+    }
+
+    // Use order of the slots, smaller means less recently used
+    uint32_t getLastUsed(const int slot) const
+    {
+        return slots[slot].lastUsed;
+    }
+
+    size_t size() const
+    {
+        size_t count = 0;
+        for (const Slot &slot : slots)
+        {
+            count += slot.used ? 1 : 0;
+        }
+        return count;
+    }
+
+    uint32_t getEvictions() const
+    {
+        return evictions;
+    }
+
+private:
+    struct Slot
+    {
+        uint32_t key;
+        size_t offset;
+        size_t length;
+        uint32_t lastUsed;
+        bool used;
+    };
+
+    int freeSlot() const
+    {
+        for (size_t i = 0; i < MAX_ENTRIES; i++)
+        {
+            if (!slots[i].used)
+            {
+                return i;
+            }
+        }
+        return NONE;
+    }
+
+    // Only called while at least one entry is cached
+    int leastRecentlyUsed() const
+    {
+        int oldest = NONE;
+        for (size_t i = 0; i < MAX_ENTRIES; i++)
+        {
+            // Wrap-safe comparison of the use counters
+            if (slots[i].used &&
+                (oldest == NONE || static_cast<int32_t>(slots[i].lastUsed - slots[oldest].lastUsed) < 0))
+            {
+                oldest = i;
+            }
+        }
+        return oldest;
+    }
+
+    uint8_t pool[POOL_SIZE];
+    size_t used = 0;
+    Slot slots[MAX_ENTRIES] = {};
+    uint32_t useCounter = 0;
+    uint32_t evictions = 0;
+};
+
+#endif // BLOBCACHE_H
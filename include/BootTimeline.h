@@ -0,0 +1,48 @@
+#ifndef BOOTTIMELINE_H
+#define BOOTTIMELINE_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+// Records when each boot phase started and finished (in ms since boot). Phases may overlap,
+// e.g. MQTT connects while the Nanoleaf is still discovered. Only the first start and finish
+// of a phase are kept, reconnects later on do not change the timeline.
+class BootTimeline
+{
+public:
+    enum Phase
+    {
+        CONFIG,
+        WIFI,
+        MQTT,
+        DISCOVERY,
+        NANOLEAF,
+        COLOR_READY, // MQTT and the Nanoleaf URL are ready, palettes are shown from now on
+        STATUS,      // Initial status and heartbeat published
+        PHASE_COUNT
+    };
+
+    void start(Phase phase);
+    void finish(Phase phase);
+
+    bool isStarted(Phase phase) const;
+    bool isFinished(Phase phase) const;
+
+    // {"phase":{"start":ms,"end":ms},...}, phases that never started are left out
+    void toJson(JsonObject phases) const;
+    void printTo(Print &out) const;
+
+private:
+    static const char *getName(Phase phase);
+
+    struct Entry
+    {
+        unsigned long startedAt = 0;
+        unsigned long finishedAt = 0;
+        bool started = false;
+        bool finished = false;
+    };
+    Entry entries[PHASE_COUNT];
+};
+
+#endif // BOOTTIMELINE_H
@@ -0,0 +1,29 @@
+#ifndef BUFFEREDCLIENTWRITER_H
+#define BUFFEREDCLIENTWRITER_H
+
+#include <Arduino.h>
+
+// Collects small writes (e.g. from serializeJson) into chunks before they hit the socket (or any other output)
+class BufferedClientWriter final : public Print
+{
+public:
+    static const size_t CHUNK_SIZE = 128;
+
+    explicit BufferedClientWriter(Print &client);
+
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t *buffer, size_t size) override;
+
+    // Sends the remaining bytes, false if any write to the socket came up short
+    bool finish();
+
+private:
+    bool flushChunk();
+
+    Print &client;
+    uint8_t chunk[CHUNK_SIZE];
+    size_t used = 0;
+    bool failed = false;
+};
+
+#endif // BUFFEREDCLIENTWRITER_H
@@ -0,0 +1,159 @@
+#ifndef COLORFRAME_H
+#define COLORFRAME_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+// Decoded palette: one color per tile plus the friend color shown on the triangles.
+// Fixed size, so frames can be copied between the ingest and the output stage without the heap.
+struct ColorFrame
+{
+    // Most tiles a palette in the 2048 byte MQTT buffer can carry ("1":[0,0,0], per tile), so no
+    // palette that reaches the controller is cut short
+    static const size_t MAX_TILES = 170;
+    static const uint8_t PACKED_VERSION = 1;
+    static const size_t PACKED_HEADER_SIZE = 6; // Magic, version and the friend color
+    static const size_t PACKED_TILE_SIZE = 5;   // Big endian tile id and the color
+    static const size_t MAX_PACKED_SIZE = PACKED_HEADER_SIZE + MAX_TILES * PACKED_TILE_SIZE;
+    static const size_t MAX_PALETTE_ID_LENGTH = 23;
+
+    struct Tile
+    {
+        uint16_t id;
+        uint8_t r;
+        uint8_t g;
+        uint8_t b;
+    };
+
+    Tile tiles[MAX_TILES];
+    size_t tileCount = 0;
+    uint8_t fromFriendColor[3] = {0, 0, 0};
+    // Id the backend assigned to the palette, empty if it has none or it is too long to keep
+    char paletteId[MAX_PALETTE_ID_LENGTH + 1] = "";
+
+    // Reads the JSON palette of the color topic ({"<tileId>": [r, g, b], ..., "fromFriendColor": [r, g, b]})
+    // A palette with only the friend color is valid, it lights the triangles
+    bool decode(const JsonObject &doc)
+    {
+        tileCount = 0;
+        bool hasFriendColor = false;
+        memset(fromFriendColor, 0, sizeof(fromFriendColor));
+        paletteId[0] = '\0';
+        for (JsonPair kv : doc)
+        {
+            auto rgb = kv.value().as<JsonArray>();
+            if (strcmp(kv.key().c_str(), "paletteId") == 0)
+            {
+                const char *id = kv.value().as<const char *>();
+                if (id != nullptr && strlen(id) <= MAX_PALETTE_ID_LENGTH)
+                {
+                    strcpy(paletteId, id);
+                }
+                continue;
+            }
+            if (strcmp(kv.key().c_str(), "fromFriendColor") == 0)
+            {
+                fromFriendColor[0] = rgb[0].as<uint8_t>();
+                fromFriendColor[1] = rgb[1].as<uint8_t>();
+                fromFriendColor[2] = rgb[2].as<uint8_t>();
+                hasFriendColor = true;
+                continue;
+            }
+
+            const long id = atol(kv.key().c_str());
+            if (id <= 0 || id > 0xFFFF)
+            {
+                Serial.printf("Skipping tile %s\n", kv.key().c_str());
+                continue;
+            }
+            if (tileCount >= MAX_TILES)
+            {
+                Serial.printf("Palette has more than %u tiles, rejected\n", (unsigned)MAX_TILES);
+                tileCount = 0;
+                return false;
+            }
+            tiles[tileCount++] = {static_cast<uint16_t>(id), rgb[0].as<uint8_t>(), rgb[1].as<uint8_t>(),
+                                  rgb[2].as<uint8_t>()};
+        }
+        return tileCount > 0 || hasFriendColor;
+    }
+
+    // Reads the packed palette of the binary color topic:
+    // 'G' 'P' <version 1> <fromFriendColor r g b>, then per tile <id high> <id low> <r> <g> <b>
+    bool decode(const uint8_t *payload, const size_t length)
+    {
+        tileCount = 0;
+        paletteId[0] = '\0';
+        if (length < PACKED_HEADER_SIZE || payload[0] != 'G' || payload[1] != 'P' || payload[2] != PACKED_VERSION ||
+            (length - PACKED_HEADER_SIZE) % PACKED_TILE_SIZE != 0)
+        {
+            Serial.printf("Invalid packed palette (%u bytes)\n", (unsigned)length);
+            return false;
+        }
+        if ((length - PACKED_HEADER_SIZE) / PACKED_TILE_SIZE > MAX_TILES)
+        {
+            Serial.printf("Palette has more than %u tiles, rejected\n", (unsigned)MAX_TILES);
+            return false;
+        }
+        fromFriendColor[0] = payload[3];
+        fromFriendColor[1] = payload[4];
+        fromFriendColor[2] = payload[5];
+
+        for (size_t offset = PACKED_HEADER_SIZE; offset < length; offset += PACKED_TILE_SIZE)
+        {
+            const uint16_t id = (payload[offset] << 8) | payload[offset + 1];
+            if (id == 0)
+            {
+                Serial.printf("Skipping tile %u\n", id);
+                continue;
+            }
+            tiles[tileCount++] = {id, payload[offset + 2], payload[offset + 3], payload[offset + 4]};
+        }
+        // The header always carries the friend color, a palette without tiles lights the triangles
+        return true;
+    }
+
+    // Writes the packed palette, buffer needs MAX_PACKED_SIZE bytes. Returns the length
+    size_t encode(uint8_t *buffer) const
+    {
+        buffer[0] = 'G';
+        buffer[1] = 'P';
+        buffer[2] = PACKED_VERSION;
+        memcpy(buffer + 3, fromFriendColor, 3);
+        size_t offset = PACKED_HEADER_SIZE;
+        for (size_t i = 0; i < tileCount; i++)
+        {
+            buffer[offset++] = tiles[i].id >> 8;
+            buffer[offset++] = tiles[i].id & 0xFF;
+            buffer[offset++] = tiles[i].r;
+            buffer[offset++] = tiles[i].g;
+            buffer[offset++] = tiles[i].b;
+        }
+        return offset;
+    }
+
+    // FNV-1a over the packed palette, so senders can compute it from the color/packed payload
+    uint32_t contentHash() const
+    {
+        uint8_t header[PACKED_HEADER_SIZE] = {'G', 'P', PACKED_VERSION, fromFriendColor[0], fromFriendColor[1],
+                                              fromFriendColor[2]};
+        uint32_t hash = 2166136261u;
+        for (const uint8_t c : header)
+        {
+            hash = (hash ^ c) * 16777619u;
+        }
+        for (size_t i = 0; i < tileCount; i++)
+        {
+            const uint8_t tile[PACKED_TILE_SIZE] = {static_cast<uint8_t>(tiles[i].id >> 8),
+                                                    static_cast<uint8_t>(tiles[i].id & 0xFF), tiles[i].r, tiles[i].g,
+                                                    tiles[i].b};
+            for (const uint8_t c : tile)
+            {
+                hash = (hash ^ c) * 16777619u;
+            }
+        }
+        return hash;
+    }
+};
+
+#endif // COLORFRAME_H
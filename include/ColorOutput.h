@@ -0,0 +1,22 @@
+#ifndef COLOROUTPUT_H
+#define COLOROUTPUT_H
+
+#include "ColorFrame.h"
+
+// Sink for the palettes received on the color topic. Implemented by the HTTP (custom effect)
+// and the UDP (extControl streaming) Nanoleaf engines.
+class ColorOutput
+{
+public:
+    virtual ~ColorOutput() = default;
+
+    virtual bool setStaticColors(const ColorFrame &frame) = 0;
+
+    // Time until the output is ready for the next frame (in ms), frames arriving meanwhile coalesce
+    virtual unsigned long getWriteDelay() const
+    {
+        return 0;
+    }
+};
+
+#endif // COLOROUTPUT_H
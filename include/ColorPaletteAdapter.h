@@ -2,24 +2,64 @@
 #define COLORPALETTEADAPTER_H
 
 #include "TopicAdapter.h"
-#include "NanoleafApiWrapper.h"
+#include "ColorOutput.h"
+#include "ColorFrame.h"
+#include "JsonArena.h"
 
 class ColorPaletteAdapter final : public TopicAdapter {
 public:
-    explicit ColorPaletteAdapter(NanoleafApiWrapper &nanoleaf): nanoleaf(nanoleaf), topic("color") {
+    static const size_t MAX_PAYLOAD_SIZE = 2048; // Same as the MQTT buffer
+    // Parsed palette of ColorFrame::MAX_TILES tiles with ArduinoJson 7.3 or later: five 8 byte slots per
+    // tile (key, array and the three channels) in pools of 64 slots, plus the key string of up to 24
+    // arena bytes. The rest covers the friend color, the paletteId and the pool list.
+    static const size_t SLOTS_PER_TILE = 5;
+    static const size_t SLOT_POOL_SIZE = 64 * 8 + 8;
+    static const size_t KEY_SIZE = 24;
+    static const size_t DOCUMENT_SIZE = ((ColorFrame::MAX_TILES * SLOTS_PER_TILE + 16) / 64 + 1) * SLOT_POOL_SIZE +
+                                        ColorFrame::MAX_TILES * KEY_SIZE + 512;
+
+    // frame is only used during callback() and may be shared with the other palette adapters
+    ColorPaletteAdapter(ColorOutput &output, ColorFrame &frame): output(&output), topic("color"), document(&arena),
+                                                                 frame(frame) {
     }
 
     [[nodiscard]] const char *getTopic() const override {
         return topic;
     }
 
+    [[nodiscard]] size_t getMaxPayloadSize() const override {
+        return MAX_PAYLOAD_SIZE;
+    }
+
+    JsonDocument &prepareDocument() override {
+        document.clear();
+        arena.reset();
+        return document;
+    }
+
+    void setOutput(ColorOutput &output) {
+        this->output = &output;
+    }
+
     void callback(char *topic, const JsonObject &payload, unsigned int length) override {
-        nanoleaf.setStaticColors(payload);
+        // The size above is derived, the largest palette so far shows how much of it is really used
+        if (arena.getUsed() > peakUsed) {
+            peakUsed = arena.getUsed();
+            Serial.printf("Palette document: %u of %u bytes for %u tiles\n", (unsigned)peakUsed,
+                          (unsigned)DOCUMENT_SIZE, (unsigned)payload.size());
+        }
+        if (frame.decode(payload)) {
+            output->setStaticColors(frame);
+        }
     }
 
 private:
-    NanoleafApiWrapper &nanoleaf;
+    ColorOutput *output;
     const char *topic;
+    JsonArena<DOCUMENT_SIZE> arena;
+    size_t peakUsed = 0;
+    JsonDocument document;
+    ColorFrame &frame;
 };
 
 #endif
@@ -0,0 +1,73 @@
+#ifndef COLORPIPELINE_H
+#define COLORPIPELINE_H
+
+#include <Arduino.h>
+#include <atomic>
+#include <functional>
+
+#include "ColorFrame.h"
+#include "ColorOutput.h"
+#include "LatestMailbox.h"
+
+// Hands decoded frames from the MQTT ingest to the Nanoleaf output. On the ESP32 the output runs
+// in its own task on the other core, so a slow panel write no longer stalls the MQTT loop.
+// The ESP8266 has a single core and writes the pending frame from loop() via pump().
+// Only the newest frame is written: palettes arriving while a write is in flight replace the
+// pending one, so a burst costs at most one extra write instead of one per palette.
+class ColorPipeline final : public ColorOutput
+{
+public:
+    struct Stats
+    {
+        uint32_t received = 0;
+        uint32_t coalesced = 0; // Replaced by a newer frame before they were written
+        uint32_t written = 0;
+        uint32_t failed = 0; // Rejected by the output
+    };
+
+    // Called after a frame was written to the output, on the output task on the ESP32
+    typedef std::function<void(const ColorFrame &frame)> WrittenCallback;
+
+    explicit ColorPipeline(ColorOutput &output);
+
+    // Starts the output task (ESP32 only)
+    void begin();
+
+    void setOutput(ColorOutput &output);
+
+    // Set before begin(), frames replaced by a newer one are never reported
+    void setWrittenCallback(WrittenCallback callback);
+
+    // Ingest side, only posts the frame
+    bool setStaticColors(const ColorFrame &frame) override;
+
+    // Writes the pending frame on single core targets, no-op when the output task runs
+    void pump();
+
+    Stats getStats() const;
+
+private:
+    void writePending();
+
+#if defined(ESP32)
+    static void outputTask(void *parameter);
+
+    TaskHandle_t outputTaskHandle = nullptr;
+#endif
+
+    ColorOutput *output;
+#if defined(ESP32)
+    LatestMailbox<ColorFrame> mailbox;
+#else
+    LatestSlot<ColorFrame> mailbox; // Ingest and output both run in loop()
+#endif
+    WrittenCallback writtenCallback;
+
+    // Counted by the ingest and the output task, which run on different cores on the ESP32
+    std::atomic<uint32_t> received{0};
+    std::atomic<uint32_t> coalesced{0};
+    std::atomic<uint32_t> written{0};
+    std::atomic<uint32_t> failed{0};
+};
+
+#endif // COLORPIPELINE_H
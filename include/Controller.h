@@ -15,26 +15,53 @@
 #include <SPIFFS.h>
 #endif
 
+#include <WiFiUdp.h>
 #include <DNSServer.h>
 #include <WiFiManager.h>
 #include <ArduinoJson.h>
+#include <atomic>
 
 // Custom Modules
 #include "MQTTClient.h"
 #include "NanoleafApiWrapper.h"
 #include "ColorPaletteAdapter.h"
+#include "PackedPaletteAdapter.h"
+#include "PaletteReplayAdapter.h"
+#include "PaletteCache.h"
+#include "NanoleafStreamingEngine.h"
+#include "CooperativeScheduler.h"
+#include "ColorPipeline.h"
+#include "BootTimeline.h"
+#include "NanoleafDiscovery.h"
+#include "NanoleafRegistry.h"
 #include "FileSystemHandler.h"
 
 // Constants
 const unsigned long PUBLISH_INTERVAL = 30000;
+const unsigned long STATUS_REFRESH_INTERVAL = 3600000; // The full status is sent this often even if the layout is unchanged (in ms)
+const unsigned long IDLE_POWER_OFF_DELAY = 360000; // Panels are turned off this long after the last color (in ms)
 const char *CONFIG_FILE = "/config.json";
-const size_t CONFIG_JSON_SIZE = 1024;
-const char *API_URL_PREFIX = "http://139.6.56.197/friends/";
+const char *LAYOUT_FILE = "/layout.json";
+const char *ADDITIONAL_LAYOUT_FILES[] = {"/layout1.json", "/layout2.json"}; // One per additional Nanoleaf
+const size_t CONFIG_JSON_SIZE = 1536;
+const char *FIRMWARE_VERSION = "1.1"; // Keep in sync with manifest.json
+const char *API_BASE_URL = "http://139.6.56.197";
+const char *API_FRIENDS_PATH = "/friends/";
+// Connect and read timeouts of the HTTP requests made from loop() (in ms). A request to a device that
+// stopped answering stalls loop() for at most about three timeouts (read on the stale keep-alive
+// connection, reconnect, read again), i.e. 4.5 s for the Nanoleaf and 9 s for the backend. The health
+// check only probes once per NanoleafApiWrapper::HEALTH_TTL without other successful requests.
+const unsigned long NANOLEAF_HTTP_TIMEOUT = 1500;
+const unsigned long BACKEND_HTTP_TIMEOUT = 3000;
 
 // WIFI Constants
 const int WIFI_MAX_ATTEMPTS = 10;      // Maximum Wifi connection attempts
 const int WIFI_RETRY_DELAY = 500;      // Delay between each attempt
 const int WIFI_CONNECT_TIMEOUT = 5000; // Maximum time to wait for the connection (in ms)
+const int WIFI_FAST_CONNECT_TIMEOUT = 2000; // Maximum time to wait for the connection with the cached lease (in ms)
+const int WIFI_FAST_POLL_INTERVAL = 10;     // Status polling interval for the connection with the cached lease (in ms)
+const unsigned long WIFI_DHCP_HANDOVER_DELAY = 10000; // A reused lease is handed back to DHCP this long after the boot (in ms)
+const unsigned long WIFI_LEASE_REFRESH_DELAY = 10000; // Time DHCP gets before the renewed lease is cached (in ms)
 
 // MDNS Constants
 const int MDNS_MAX_RETRIES = 10;           // Maximum MDNS Retries
@@ -44,21 +71,67 @@ const float MDNS_BACKOFF_FACTOR = 1.5;     // Backoff factor for exponential del
 // MQTT Constants
 const char *DEFAULT_MQTT_BROKER = "hivemq.dock.moxd.io"; // MQTT Broker Address
 const int DEFAULT_MQTT_PORT = 1883;                      // MQTT Broker Port
+const bool MQTT_HEARTBEAT = true;                        // Publish heartbeats with the uptime on the presence topic
+
+// Nanoleaf Retry Policies (initial delay, max delay, backoff factor, max attempts)
+const CooperativeScheduler::RetryPolicy NANOLEAF_CONNECT_RETRY = {6000, 6000, 1.0, 6};
+const CooperativeScheduler::RetryPolicy NANOLEAF_DISCOVERY_RETRY = {1000, 10000, 1.5, 0};
+const CooperativeScheduler::RetryPolicy EVENT_REGISTRATION_RETRY = {1000, 300000, 2.0, 0};
+const unsigned int EVENT_POLLING_FALLBACK_ATTEMPTS = 5; // Failed registrations until the layout is polled on every heartbeat
+
+// Additional Nanoleaf Constants
+const unsigned long ADDITIONAL_PAIRING_WINDOW = 30000; // Time to pair further discovered Nanoleafs during the setup (in ms)
+
+// Color Output Constants
+const bool USE_UDP_STREAMING = false; // Stream palettes via extControl (UDP) instead of custom effects (HTTP)
+
+// Palette Cache Constants
+const char *PALETTE_CACHE_FILE = "/palettes.json";
+const bool PALETTE_CACHE_PERSIST = true;               // Keep cached palettes across restarts
+const unsigned long PALETTE_CACHE_SAVE_DELAY = 300000; // New palettes are written to flash at most this often (in ms)
 
 // Function Prototypes
 void initializeUUID();
 void loadConfigFromFile();
 void saveConfigToFile();
 bool generateMDNSNanoleafURL();
+bool useDiscoveredNanoleaf();
+bool tryNanoleafDiscovery();
+void onNanoleafDiscovered();
+void onNanoleafQueryFinished();
+void updateBootTimeline();
+void colorCallback();
+void blink_led(int blinkDelay);
+void setupAdditionalNanoleafs();
+void pairAdditionalNanoleafs();
+bool isAdditionalNanoleaf(const char *deviceId);
+void updateAdditionalNanoleafAddresses();
 void attemptNanoleafConnection();
 void setupWiFiManager();
 void setupMQTTClient();
+void onPaletteMiss(const JsonObject &request);
+void savePaletteCache();
 void publishStatus();
+uint32_t hashLayout(const std::vector<String> &tileIds);
+int sendStatusPatch(const JsonDocument &jsonPayload, JsonDocument &response);
+void refreshStatus();
 void saveConfigCallback();
 void connectToWifi();
 void generateShortUUID(char *uuid, size_t length);
 void connectToWifi(bool useSavedCredentials = true);
-void registerNanoleafEvents();
+bool connectToWifiWithCachedLease();
+bool wasSoftReset();
+void handOverWifiToDhcp();
+void finishDhcpHandover();
+void updateWifiLease();
+bool tryRegisterNanoleafEvents();
+void onEventStreamLost();
+bool tryNanoleafConnection();
+void onNanoleafConnected();
+void onNanoleafConnectionFailed();
+void setupTasks();
+void publishHeartbeat();
+void publishInitialHeartbeat();
 void performReset();
 bool resetBtnLongPress();
 void IRAM_ATTR handleResetInterrupt();
@@ -0,0 +1,89 @@
+#ifndef COOPERATIVESCHEDULER_H
+#define COOPERATIVESCHEDULER_H
+
+#include <Arduino.h>
+#include <functional>
+#include <vector>
+
+// Runs one-shot, periodic and retrying tasks from loop() instead of blocking with delay().
+// Tasks are registered once and then started, rescheduled or stopped by their id.
+class CooperativeScheduler
+{
+public:
+    typedef size_t TaskId;
+    typedef std::function<void()> TaskCallback;
+    // Returns true once the work succeeded, false schedules the next attempt
+    typedef std::function<bool()> RetryCallback;
+
+    struct RetryPolicy
+    {
+        unsigned long initialDelay; // Delay before the second attempt (in ms)
+        unsigned long maxDelay;     // Cap of the backoff (in ms)
+        float backoffFactor;        // Multiplier per failed attempt, 1 keeps the delay fixed
+        unsigned int maxAttempts;   // 0 retries forever
+    };
+
+    struct TaskStats
+    {
+        const char *name;
+        uint32_t runs;
+        uint64_t totalMicros; // A uint32_t would wrap after about 71 minutes
+        uint32_t maxMicros;
+    };
+
+    TaskId addOneShot(const char *name, TaskCallback callback);
+
+    TaskId addPeriodic(const char *name, unsigned long interval, TaskCallback callback);
+
+    // onGiveUp is called when maxAttempts failed in a row
+    TaskId addRetry(const char *name, const RetryPolicy &policy, RetryCallback callback,
+                    TaskCallback onGiveUp = nullptr);
+
+    // (Re)starts a task, the first run happens after delay. Retry tasks start counting attempts anew
+    void start(TaskId id, unsigned long delay = 0);
+
+    void stop(TaskId id);
+
+    bool isActive(TaskId id) const;
+
+    // Attempts made by a retry task since it was started
+    unsigned int getAttempts(TaskId id) const;
+
+    // Runs every due task once
+    void run();
+
+    const TaskStats &getStats(TaskId id) const;
+
+    void printStats(Print &out) const;
+
+private:
+    enum TaskType : uint8_t
+    {
+        ONE_SHOT,
+        PERIODIC,
+        RETRY
+    };
+
+    struct Task
+    {
+        TaskType type;
+        bool active;
+        unsigned long dueAt;
+        unsigned long interval;
+        TaskCallback callback;
+        RetryCallback retryCallback;
+        TaskCallback onGiveUp;
+        RetryPolicy policy;
+        unsigned int attempts;
+        unsigned long retryDelay;
+        TaskStats stats;
+    };
+
+    TaskId add(const char *name, TaskType type);
+
+    void execute(Task &task, unsigned long now);
+
+    std::vector<Task> tasks;
+};
+
+#endif // COOPERATIVESCHEDULER_H
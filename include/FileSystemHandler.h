@@ -12,12 +12,29 @@
 #define FILESYSTEM LITTLEFS
 #endif
 
+// JSON files are stored behind a "#<crc32>\n" header and replaced atomically: the new content
+// is written to "<path>.tmp" and renamed over the old file, so a power cut leaves either the old
+// or the new file. Files without a header (older firmware) are still read.
 class FileSystemHandler
 {
 public:
+    static const size_t MAX_TRACKED_FILES = 5; // Files whose content checksum is kept in RAM
+    static const size_t MAX_PATH_LENGTH = 31;
+
+    // Mounts the file system once, every other call mounts it on demand
+    static bool mount();
+
     static bool loadConfigFromFile(const char *path, JsonDocument &jsonDoc, size_t jsonSize);
+
+    // Skips the write if the file already holds the same content
     static bool saveConfigToFile(const char *path, const JsonDocument &jsonDoc);
+
     static bool removeConfigFile(const char *path);
+
+private:
+    static bool findChecksum(const char *path, uint32_t &crc);
+    static void rememberChecksum(const char *path, uint32_t crc);
+    static void forgetChecksum(const char *path);
 };
 
-#endif // FILESYSTEMHANDLER_H
\ No newline at end of file
+#endif // FILESYSTEMHANDLER_H
@@ -0,0 +1,136 @@
+#ifndef HTTPCONNECTIONMANAGER_H
+#define HTTPCONNECTIONMANAGER_H
+
+#include <Arduino.h>
+
+#if defined(ESP8266)
+#include <ESP8266WiFi.h>
+#else
+#include <WiFi.h>
+#endif
+
+#include <memory>
+#include <vector>
+
+#include "BufferedClientWriter.h"
+
+// Response body of a single request. Stops at Content-Length or the last chunk, so the
+// connection can be reused for the next request.
+class HttpBodyStream final : public Stream
+{
+public:
+    void begin(WiFiClient *client, long contentLength, bool chunked, unsigned long timeout);
+
+    bool finished();
+
+    // Discards everything up to the end of the body
+    void drain();
+
+    using Stream::readBytes;
+
+    int available() override;
+    int read() override;
+    int peek() override;
+    size_t readBytes(char *buffer, size_t length) override;
+    size_t write(uint8_t) override { return 0; }
+
+private:
+    bool nextChunk();
+
+    WiFiClient *client = nullptr;
+    long remaining = 0; // Bytes left in the body (or current chunk), -1 reads until the server closes
+    bool chunked = false;
+    bool firstChunk = true;
+    bool done = true;
+};
+
+// Single HTTP/1.1 keep-alive connection to one device
+class HttpConnection
+{
+public:
+    struct Stats
+    {
+        uint32_t requests = 0;
+        uint32_t reused = 0;     // Requests sent over an already open connection
+        uint32_t handshakes = 0; // TCP connects
+        uint32_t failures = 0;
+    };
+
+    static const unsigned long TIMEOUT = 5000; // Default connect and read timeout (in ms)
+
+    HttpConnection(const String &host, uint16_t port, unsigned long timeout = TIMEOUT);
+
+    // Connects (or reuses the open connection) and sends the request line and headers
+    bool beginRequest(const char *method, const String &path, size_t contentLength,
+                      const char *contentType = "application/json");
+
+    // Request body is written here between beginRequest() and endRequest()
+    WiFiClient &requestBody();
+
+    // Reads the status line and headers. Returns the status code or -1 on failure
+    int endRequest();
+
+    HttpBodyStream &responseBody();
+
+    // Skips the unread part of the response, closes the connection if the server asked for it
+    void endResponse();
+
+    void stop();
+
+    bool wasReused() const;
+
+    bool matches(const String &host, uint16_t port) const;
+
+    const Stats &getStats() const;
+
+private:
+    WiFiClient client;
+    HttpBodyStream body;
+    String host;
+    uint16_t port;
+    unsigned long timeout;
+    bool reused = false;
+    bool keepAlive = true;
+    Stats stats;
+};
+
+// Keeps one connection per device (host/port), shared by all requests to that device.
+// A connection is checked out by acquire() until release(), so it is never handed out twice or
+// evicted while a request (e.g. between beginStaticColors and finishStaticColors) still uses it.
+// Safe to use from loop() and the color output task.
+class HttpConnectionManager
+{
+public:
+    static const size_t MAX_CONNECTIONS = 4;
+
+    // timeout applies to connecting and to every read of the connections (in ms)
+    explicit HttpConnectionManager(unsigned long timeout = HttpConnection::TIMEOUT);
+    ~HttpConnectionManager();
+
+    // Checks out the connection for a base URL of the form http://<host>:<port>. Returns nullptr
+    // without a host or when all MAX_CONNECTIONS are checked out
+    HttpConnection *acquire(const String &baseUrl);
+    void release(HttpConnection *connection);
+
+    // Closes every connection that is not checked out, they reconnect on their next request
+    void stopIdle();
+
+    HttpConnection::Stats getStats();
+
+    unsigned long getTimeout() const;
+
+private:
+    struct Slot
+    {
+        std::unique_ptr<HttpConnection> connection;
+        bool checkedOut;
+    };
+
+#if defined(ESP32)
+    SemaphoreHandle_t mutex;
+#endif
+    unsigned long timeout;
+    std::vector<Slot> slots;
+};
+
+#endif // HTTPCONNECTIONMANAGER_H
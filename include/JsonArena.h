@@ -0,0 +1,94 @@
+#ifndef JSONARENA_H
+#define JSONARENA_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+// Fixed size allocator for a JsonDocument that is reused for every message. Allocations are
+// carved out of a static buffer and released all at once with reset(), so parsing a message
+// neither touches nor fragments the heap. A payload that does not fit fails with NoMemory.
+template <size_t CAPACITY>
+class JsonArena final : public ArduinoJson::Allocator
+{
+public:
+    void *allocate(size_t size) override
+    {
+        const size_t required = HEADER_SIZE + align(size);
+        if (used + required > CAPACITY)
+        {
+            return nullptr;
+        }
+
+        uint8_t *block = buffer + used;
+        *reinterpret_cast<size_t *>(block) = size;
+        last = block + HEADER_SIZE;
+        used += required;
+        return last;
+    }
+
+    void deallocate(void *) override
+    {
+        // Released with reset()
+    }
+
+    void *reallocate(void *ptr, size_t newSize) override
+    {
+        if (ptr == nullptr)
+        {
+            return allocate(newSize);
+        }
+
+        size_t *size = reinterpret_cast<size_t *>(static_cast<uint8_t *>(ptr) - HEADER_SIZE);
+
+        // The most recent block can grow or shrink in place
+        if (ptr == last)
+        {
+            const size_t start = static_cast<uint8_t *>(ptr) - buffer;
+            if (start + align(newSize) > CAPACITY)
+            {
+                return nullptr;
+            }
+            used = start + align(newSize);
+            *size = newSize;
+            return ptr;
+        }
+
+        if (newSize <= *size)
+        {
+            return ptr;
+        }
+        void *moved = allocate(newSize);
+        if (moved != nullptr)
+        {
+            memcpy(moved, ptr, *size);
+        }
+        return moved;
+    }
+
+    // Only valid once the document using this arena has been cleared
+    void reset()
+    {
+        used = 0;
+        last = nullptr;
+    }
+
+    size_t getUsed() const
+    {
+        return used;
+    }
+
+private:
+    static const size_t ALIGNMENT = 8;
+    static const size_t HEADER_SIZE = ALIGNMENT;
+
+    static size_t align(size_t size)
+    {
+        return (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+    }
+
+    alignas(ALIGNMENT) uint8_t buffer[CAPACITY];
+    size_t used = 0;
+    void *last = nullptr;
+};
+
+#endif // JSONARENA_H
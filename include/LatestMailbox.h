@@ -0,0 +1,86 @@
+#ifndef LATESTMAILBOX_H
+#define LATESTMAILBOX_H
+
+#include <atomic>
+#include <stdint.h>
+
+// Lock-free single producer / single consumer mailbox that only keeps the newest item
+// (triple buffer). Posting never blocks or fails: an item the consumer has not taken yet is
+// simply replaced. Producer and consumer may run on different cores.
+template <typename T>
+class LatestMailbox
+{
+public:
+    // Producer side, returns false if an unread item was replaced
+    bool post(const T &item)
+    {
+        slots[back] = item;
+        const uint8_t previous = middle.exchange(back | FRESH, std::memory_order_acq_rel);
+        back = previous & INDEX_MASK;
+        return (previous & FRESH) == 0;
+    }
+
+    // Consumer side, nullptr if nothing new was posted since the last take.
+    // The item stays valid until the next take
+    const T *take()
+    {
+        if ((middle.load(std::memory_order_acquire) & FRESH) == 0)
+        {
+            return nullptr;
+        }
+        const uint8_t previous = middle.exchange(front, std::memory_order_acq_rel);
+        front = previous & INDEX_MASK;
+        return &slots[front];
+    }
+
+    bool hasItem() const
+    {
+        return (middle.load(std::memory_order_acquire) & FRESH) != 0;
+    }
+
+private:
+    static const uint8_t INDEX_MASK = 0x03;
+    static const uint8_t FRESH = 0x04;
+
+    T slots[3];
+    uint8_t back = 0;  // Only touched by the producer
+    uint8_t front = 1; // Only touched by the consumer
+    std::atomic<uint8_t> middle{2};
+};
+
+// Single slot counterpart for targets where producer and consumer run in the same thread (the
+// ESP8266 loop()). Same interface, a third of the memory: nothing can post while the taken item
+// is in use, so it needs no buffers of its own.
+template <typename T>
+class LatestSlot
+{
+public:
+    bool post(const T &item)
+    {
+        slot = item;
+        const bool wasFresh = fresh;
+        fresh = true;
+        return !wasFresh;
+    }
+
+    const T *take()
+    {
+        if (!fresh)
+        {
+            return nullptr;
+        }
+        fresh = false;
+        return &slot;
+    }
+
+    bool hasItem() const
+    {
+        return fresh;
+    }
+
+private:
+    T slot;
+    bool fresh = false;
+};
+
+#endif // LATESTMAILBOX_H
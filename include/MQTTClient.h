@@ -9,12 +9,30 @@
 
 #include <PubSubClient.h>
 #include <vector>
+#include <functional>
 #include <ArduinoJson.h>
 #include "TopicAdapter.h"
+#include "TopicRouter.h"
 
 class MQTTClient
 {
 public:
+    struct Stats
+    {
+        uint32_t reconnects = 0;       // Successful connects after a lost connection
+        uint32_t failedAttempts = 0;   // Connects or subscriptions that failed
+        uint32_t disconnectedMs = 0;   // Total time spent without a broker connection (in ms)
+        unsigned long disconnectedSince = 0;
+        bool disconnected = true;
+    };
+
+    static const unsigned long RECONNECT_MIN_DELAY = 1000;  // First retry (in ms)
+    static const unsigned long RECONNECT_MAX_DELAY = 60000; // Cap of the exponential backoff (in ms)
+    static const uint16_t SOCKET_TIMEOUT = 5;               // Limits a single connect attempt (in s)
+    static const int MAX_PACKETS_PER_LOOP = 8;              // Buffered packets handled per loop() call
+
+    typedef std::function<void()> ConnectCallback;
+
     explicit MQTTClient(WiFiClient &wifiClient);
 
     void setup(const char *mqttBroker, int mqttPort, const char *friendId);
@@ -23,10 +41,28 @@ public:
 
     void publish(const char *topic, const JsonDocument &jsonPayload);
 
+    // GeoGlow/<friendId>/status, holds the retained presence ({"online":true}, the Last Will
+    // replaces it with {"online":false} when the connection drops)
+    const String &getPresenceTopic() const;
+
     void addTopicAdapter(TopicAdapter *adapter);
 
+    // Called after every successful (re)connect
+    void setConnectCallback(ConnectCallback callback);
+
+    bool connected();
+
+    // Closes the session, loop() reconnects right away (e.g. after the local address changed)
+    void disconnect();
+
+    // Includes the currently running disconnect
+    Stats getStats() const;
+
 private:
-    void reconnect();
+    // Makes at most one connect attempt per call, never waits for the next one
+    void reconnect(unsigned long now);
+
+    bool subscribeAll();
 
     String buildTopic(const TopicAdapter *adapter) const;
 
@@ -34,11 +70,16 @@ private:
 
     void callback(char *topic, byte *payload, unsigned int length);
 
-    static bool matches(const String &subscribedTopic, const String &receivedTopic);
-
+    WiFiClient &network;
     PubSubClient client;
     String friendId;
-    static std::vector<TopicAdapter *> topicAdapters;
+    String presenceTopic;
+    Stats stats;
+    unsigned long nextAttemptAt = 0;
+    unsigned long backoff = RECONNECT_MIN_DELAY;
+    bool connectedBefore = false; // The first connect is not counted as a reconnect
+    TopicRouter router;
+    ConnectCallback connectCallback;
     static MQTTClient *instance;
 };
 
@@ -12,13 +12,40 @@
 #include <ArduinoJson.h>
 #include <vector>
 
-class NanoleafApiWrapper
+#include "AnimDataEncoder.h"
+#include "BlobCache.h"
+#include "ColorOutput.h"
+#include "HttpConnectionManager.h"
+#include "WritePacer.h"
+#include "FileSystemHandler.h"
+#include "SseParser.h"
+
+class NanoleafApiWrapper final : public ColorOutput
 {
 public:
-    explicit NanoleafApiWrapper(const WiFiClient &wifiClient);
+    // Serializes access between loop() and the color output task on the ESP32, no-op on the ESP8266
+    class Lock
+    {
+    public:
+        Lock() = default;
+        explicit Lock(NanoleafApiWrapper &nanoleaf);
+        ~Lock();
+
+        // For locks that are taken later, e.g. one per device in an array
+        void acquire(NanoleafApiWrapper &nanoleaf);
+
+    private:
+        NanoleafApiWrapper *nanoleaf = nullptr;
+    };
+
+    explicit NanoleafApiWrapper(HttpConnectionManager &connections);
+    ~NanoleafApiWrapper();
 
     void setup(const char *nanoleafBaseUrl, const char *nanoleafAuthToken);
 
+    static const unsigned long HEALTH_TTL = 120000; // Validity of a confirmed connection (in ms)
+
+    // Only probes the panels if no authenticated request succeeded within HEALTH_TTL
     bool isConnected();
 
     String generateToken();
@@ -27,37 +54,158 @@ public:
 
     String events();
 
+    static const size_t LAYOUT_SNAPSHOT_SIZE = 2048;
+#if defined(ESP32)
+    // Encoded bodies of recent palettes (ESP32 only): two of a full palette or several small ones
+    static const size_t BODY_CACHE_SIZE =
+        2 * (AnimDataEncoder::FRAME_LENGTH + ColorFrame::MAX_TILES * AnimDataEncoder::MAX_ENTRY_LENGTH);
+    static const size_t BODY_CACHE_ENTRIES = 8;
+#endif
+
+    // Cached layout, only queried from the panels after invalidateLayout() (layout event) or
+    // when no valid layout is known yet
     std::vector<String> getPanelIds();
+    bool refreshLayout();
+    void invalidateLayout();
+
+    // Loads the layout persisted at path and keeps it updated there
+    bool restoreLayout(const char *path);
 
     bool setPower(const bool &state);
 
+    static const int EVENT_KEEPALIVE_IDLE = 30;     // Silence before the first keepalive probe (in s)
+    static const int EVENT_KEEPALIVE_INTERVAL = 10; // Interval between unanswered probes (in s)
+    static const int EVENT_KEEPALIVE_COUNT = 3;     // Unanswered probes until the stream counts as lost
+
+    // (Re)opens the event stream, an already open stream is closed first
     bool registerEvents(const std::vector<int> &eventIds);
+    bool isListeningForEvents() const;
+
+    // Closes the event stream without reporting it as lost
+    void closeEvents();
+
+    // Called from processEvents() once when an open stream was closed or timed out
+    typedef std::function<void()> EventStreamLostCallback;
+    void setEventStreamLostCallback(EventStreamLostCallback callback);
 
+    // Drains the event stream without blocking and dispatches complete events
     void processEvents();
 
+    // Event ids of the Nanoleaf event stream
+    enum class EventType
+    {
+        STATE = 1,
+        LAYOUT = 2,
+        EFFECTS = 3,
+        TOUCH = 4
+    };
+
+    // Receives the JSON data of the event, e.g. {"events":[{"attr":1}]}
+    typedef std::function<void(const char *data, size_t length)> EventCallback;
+    void setEventCallback(EventType type, EventCallback callback);
+
     typedef std::function<void()> LayoutChangeCallback;
     typedef std::function<void()> ColorCallback;
     void setLayoutChangeCallback(LayoutChangeCallback callback);
     void setColorCallback(ColorCallback callback);
-    bool setStaticColors(const JsonObject &doc);
+    bool setStaticColors(const ColorFrame &frame) override;
+
+    // setStaticColors() in two halves to write to several devices at once: begin sends the effect
+    // without waiting, finish reads the response. The Lock has to be held from begin to finish
+    bool beginStaticColors(const ColorFrame &frame);
+    bool finishStaticColors();
+
+    // Whether the cached layout contains the panel, never queries the panels
+    bool hasPanel(uint16_t panelId);
+    bool hasTriangles();
+    unsigned long getWriteDelay() const override;
     void setStaticColor(const int rgb[3]);
 
+    bool enableExternalControl();
+    bool isExternalControlActive() const;
+    const String &getBaseUrl() const;
+    const std::vector<String> &getTriangleIds() const;
+    HttpConnection::Stats getConnectionStats() const;
+    const WritePacer::Stats &getPacerStats() const;
+
 private:
+    // responseFilter limits the parsed response to the fields the caller needs
     bool sendRequest(
         const String &method,
         const String &endpoint,
         const JsonDocument *requestBody,
         JsonDocument *responseBody,
+        bool useAuthToken,
+        const JsonDocument *responseFilter = nullptr);
+
+    bool sendRequest(
+        const String &method,
+        const String &endpoint,
+        const char *requestBody,
+        size_t requestBodyLength,
+        JsonDocument *responseBody,
         bool useAuthToken);
 
+    typedef std::function<bool(WiFiClient &)> BodyWriter;
+    bool sendRequest(
+        const String &method,
+        const String &endpoint,
+        size_t requestBodyLength,
+        const BodyWriter &writeBody,
+        JsonDocument *responseBody,
+        bool useAuthToken,
+        const JsonDocument *responseFilter = nullptr);
+
+    String buildPath(const String &endpoint, bool useAuthToken) const;
+    bool writeRequest(HttpConnection &connection, const char *method, const String &path,
+                      size_t requestBodyLength, const BodyWriter &writeBody);
+    int readResponse(HttpConnection &connection, const char *method, const String &path,
+                     size_t requestBodyLength, const BodyWriter &writeBody);
+    bool finishRequest(HttpConnection &connection, const char *method, bool useAuthToken, bool paced,
+                       int httpResponseCode, JsonDocument *responseBody, const JsonDocument *responseFilter);
+    BodyWriter effectBodyWriter() const;
+    bool encodeFrame(const ColorFrame &frame, uint32_t frameHash);
+    void discardEncodedFrames();
+
+#if defined(ESP32)
+    SemaphoreHandle_t mutex;
+    BlobCache<BODY_CACHE_SIZE, BODY_CACHE_ENTRIES> bodyCache; // Keyed by the content hash of the frame
+#endif
+    AnimDataEncoder animDataEncoder;
+    uint32_t encodedFrameHash = 0; // Content hash of the frame animDataEncoder holds
+    bool encodedFrameValid = false;
+    const char *pendingBody = nullptr; // Encoder or body cache, valid until the next write
+    size_t pendingBodyLength = 0;
+    HttpConnection *pendingConnection = nullptr;
+    String pendingPath;
+    bool pendingWritten = false;
+    WritePacer pacer;
+    void updateHealth(bool useAuthToken, int httpResponseCode);
+    void saveLayout();
+    String tokenFingerprint() const;
+    void handleEvent(const SseParser::Event &event);
+    void enableKeepAlive();
+    void closeEventStream();
+    void indexPanels();
+
+    std::vector<String> panelIds;
+    std::vector<uint16_t> panelNumbers; // panelIds as sorted numbers for hasPanel()
     std::vector<String> triangleIds;
+    bool layoutValid = false;
+    const char *layoutPath = nullptr;
     String nanoleafBaseUrl;
     String nanoleafAuthToken;
-    WiFiClient client;
+    HttpConnectionManager &connections;
+    WiFiClient eventStreamClient;
     HTTPClient httpClient;
-    WiFiClient *eventClient;
+    WiFiClient *eventClient = nullptr;
     bool registeredForEvents = false;
-    LayoutChangeCallback layoutChangeCallback;
+    bool externalControlActive = false;
+    bool healthConfirmed = false;
+    unsigned long healthConfirmedAt = 0;
+    SseParser eventParser;
+    EventCallback eventCallbacks[4];
+    EventStreamLostCallback eventStreamLostCallback;
     ColorCallback colorCallback;
 };
 
@@ -0,0 +1,77 @@
+#ifndef NANOLEAFDISCOVERY_H
+#define NANOLEAFDISCOVERY_H
+
+#include <Arduino.h>
+#include <functional>
+
+#if defined(ESP8266)
+#include <ESP8266mDNS.h>
+#else
+#include <ESPmDNS.h>
+#include <mdns.h>
+#endif
+
+// Asynchronous mDNS discovery of all _nanoleafapi._tcp responders. A query collects answers in
+// the background for QUERY_DURATION, the devices found are cached for CACHE_TTL and identified by
+// the "id" TXT record, so a controller always finds its own Nanoleaf again, even if several
+// devices answer or its address changed.
+class NanoleafDiscovery
+{
+public:
+    static const unsigned long QUERY_DURATION = 3000; // Time answers are collected per query (in ms)
+    static const unsigned long CACHE_TTL = 600000;    // Validity of a discovered address (in ms)
+    static const size_t MAX_DEVICES = 4;
+    static const size_t MAX_ID_LENGTH = 23;
+
+    struct Device
+    {
+        char id[MAX_ID_LENGTH + 1];
+        IPAddress ip;
+        uint16_t port;
+        unsigned long seenAt;
+    };
+
+    typedef std::function<void()> QueryFinishedCallback;
+
+    bool begin(const char *hostname);
+
+    // Starts a query unless one is running, answers arrive while loop() is called
+    bool startQuery();
+    bool isQueryRunning() const;
+
+    void loop();
+
+    void setQueryFinishedCallback(QueryFinishedCallback callback);
+
+    // The cached device with deviceId. Without a deviceId the device at baseUrl (the address used
+    // so far) is preferred over the first one that answered. nullptr if no such device answered
+    // within CACHE_TTL
+    const Device *select(const char *deviceId, const char *baseUrl = nullptr) const;
+
+    // Number of devices that answered within CACHE_TTL
+    size_t getDeviceCount() const;
+
+    // The index-th device that answered within CACHE_TTL, nullptr past the end
+    const Device *getDevice(size_t index) const;
+
+    // http://<ip>:<port>
+    static void buildBaseUrl(const Device &device, char *url, size_t size);
+
+private:
+    void addDevice(const char *id, const IPAddress &ip, uint16_t port);
+    void finishQuery();
+    bool isFresh(const Device &device) const;
+
+    Device devices[MAX_DEVICES] = {};
+    bool started = false;
+    bool queryRunning = false;
+    unsigned long queryStartedAt = 0;
+#if defined(ESP8266)
+    MDNSResponder::hMDNSServiceQuery query = nullptr;
+#else
+    mdns_search_once_t *query = nullptr;
+#endif
+    QueryFinishedCallback queryFinishedCallback;
+};
+
+#endif // NANOLEAFDISCOVERY_H
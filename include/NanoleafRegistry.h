@@ -0,0 +1,64 @@
+#ifndef NANOLEAFREGISTRY_H
+#define NANOLEAFREGISTRY_H
+
+#include <Arduino.h>
+#include <memory>
+#include <vector>
+
+#include "ColorFrame.h"
+#include "ColorOutput.h"
+#include "HttpConnectionManager.h"
+#include "NanoleafApiWrapper.h"
+#include "NanoleafStreamingEngine.h"
+
+// All Nanoleafs driven by this controller. The primary device is the one the controller was set
+// up with, additional devices have their own token, layout and event stream. A palette is split
+// by the layouts (tiles unknown to every device go to the primary) and written to all devices at
+// once: every request is sent before the first response is read, so N devices take about as
+// long as the slowest one instead of the sum of all. With streaming enabled, each device gets its
+// part as an extControl UDP frame instead, devices where streaming failed keep using HTTP.
+class NanoleafRegistry final : public ColorOutput
+{
+public:
+    static const size_t MAX_DEVICES = 3;
+
+    NanoleafRegistry(NanoleafApiWrapper &primary, HttpConnectionManager &connections);
+
+    // Creates an additional device, nullptr if MAX_DEVICES is reached
+    NanoleafApiWrapper *addDevice();
+
+    size_t size() const;
+    NanoleafApiWrapper &get(size_t index);
+
+    bool setStaticColors(const ColorFrame &frame) override;
+
+    // (Re)enables UDP streaming on every device, called on each connect since the panels drop
+    // extControl when they restart. False if it failed on any device
+    bool beginStreaming(UDP &udp, NanoleafApiWrapper::ColorCallback colorCallback);
+
+    // Probes every device. Additional devices that do not answer are left out of setStaticColors()
+    // until they answer again, only the primary device decides about a reconnect
+    bool isConnected();
+
+    // Slowest pacing of all devices
+    unsigned long getWriteDelay() const override;
+
+    // Panels of all devices
+    std::vector<String> getPanelIds();
+
+    void processEvents();
+
+private:
+    bool writeDevice(size_t index, const ColorFrame &frame);
+
+    NanoleafApiWrapper *devices[MAX_DEVICES] = {};
+    std::unique_ptr<NanoleafApiWrapper> additionalDevices[MAX_DEVICES - 1];
+    size_t count = 1;
+    HttpConnectionManager &connections;
+    std::unique_ptr<ColorFrame[]> frames; // Per device part of a palette, only allocated with additional devices
+    std::unique_ptr<NanoleafStreamingEngine> streamingEngines[MAX_DEVICES]; // Only allocated when streaming
+    bool streaming[MAX_DEVICES] = {};
+    bool healthy[MAX_DEVICES] = {true, true, true};
+};
+
+#endif // NANOLEAFREGISTRY_H
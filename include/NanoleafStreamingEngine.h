@@ -0,0 +1,53 @@
+#ifndef NANOLEAFSTREAMINGENGINE_H
+#define NANOLEAFSTREAMINGENGINE_H
+
+#include <Arduino.h>
+#include <Udp.h>
+#include <IPAddress.h>
+
+#include "ColorFrame.h"
+#include "ColorOutput.h"
+#include "NanoleafApiWrapper.h"
+
+// Pushes palettes to the panels as extControl (v2) UDP frames instead of custom effects.
+// The streaming mode is enabled once over HTTP and re-enabled whenever another effect replaced it.
+class NanoleafStreamingEngine final : public ColorOutput
+{
+public:
+    static const uint16_t DEFAULT_PORT = 60222; // Fixed extControl port of the Nanoleaf controllers
+    // As many panels as fit one unfragmented datagram (1472 bytes), covers a full palette plus triangles
+    static const size_t MAX_PANELS = (1472 - 2) / 8;
+    static const uint16_t TRANSITION_TIME = 30; // In 100ms steps, same fade as the custom effect
+
+    NanoleafStreamingEngine(NanoleafApiWrapper &nanoleaf, UDP &udp);
+
+    // Streams to the host of the wrapper's base URL.
+    bool begin();
+
+    // Streams to an explicit target, e.g. a local UDP stand-in.
+    bool begin(const IPAddress &host, uint16_t port = DEFAULT_PORT);
+
+    bool setStaticColors(const ColorFrame &colors) override;
+
+    void setColorCallback(NanoleafApiWrapper::ColorCallback callback);
+
+private:
+    bool ensureStreaming();
+
+    bool appendPanel(uint16_t panelId, uint8_t r, uint8_t g, uint8_t b);
+
+    NanoleafApiWrapper &nanoleaf;
+    UDP &udp;
+    IPAddress host;
+    uint16_t port = DEFAULT_PORT;
+    bool hostResolved = false;
+    NanoleafApiWrapper::ColorCallback colorCallback;
+
+    static_assert(MAX_PANELS >= ColorFrame::MAX_TILES, "A full palette has to fit one frame");
+
+    uint8_t frame[2 + MAX_PANELS * 8];
+    size_t frameLength = 0;
+    uint16_t panelCount = 0;
+};
+
+#endif // NANOLEAFSTREAMINGENGINE_H
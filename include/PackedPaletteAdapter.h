@@ -0,0 +1,52 @@
+#ifndef PACKEDPALETTEADAPTER_H
+#define PACKEDPALETTEADAPTER_H
+
+#include "TopicAdapter.h"
+#include "ColorOutput.h"
+
+// Binary counterpart of the ColorPaletteAdapter on its own topic, so senders can switch over
+// gradually. The payload is read with a linear scan, the JSON parser is not involved.
+class PackedPaletteAdapter final : public TopicAdapter {
+public:
+    static const size_t MAX_PAYLOAD_SIZE = ColorFrame::MAX_PACKED_SIZE;
+
+    // frame is only used during handleRaw() and may be shared with the other palette adapters
+    PackedPaletteAdapter(ColorOutput &output, ColorFrame &frame): output(&output), topic("color/packed"), frame(frame) {
+    }
+
+    [[nodiscard]] const char *getTopic() const override {
+        return topic;
+    }
+
+    [[nodiscard]] size_t getMaxPayloadSize() const override {
+        return MAX_PAYLOAD_SIZE;
+    }
+
+    // Never parsed as JSON, handleRaw() takes every payload
+    JsonDocument &prepareDocument() override {
+        document.clear();
+        return document;
+    }
+
+    void setOutput(ColorOutput &output) {
+        this->output = &output;
+    }
+
+    bool handleRaw(char *topic, const uint8_t *payload, unsigned int length) override {
+        if (frame.decode(payload, length)) {
+            output->setStaticColors(frame);
+        }
+        return true;
+    }
+
+    void callback(char *topic, const JsonObject &payload, unsigned int length) override {
+    }
+
+private:
+    ColorOutput *output;
+    const char *topic;
+    JsonDocument document;
+    ColorFrame &frame;
+};
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef PALETTECACHE_H
+#define PALETTECACHE_H
+
+#include <Arduino.h>
+
+#include "BlobCache.h"
+#include "ColorFrame.h"
+
+// Recently displayed palettes, so a resent palette can be replayed by its id (assigned by the
+// backend) or its content hash instead of being transmitted and decoded again. Palettes are kept
+// in their packed form in a fixed pool, least recently used ones are evicted first.
+// Safe to use from loop() and the color output task.
+class PaletteCache
+{
+public:
+#if defined(ESP8266)
+    static const size_t POOL_SIZE = 1024; // About eight palettes of 25 tiles
+    static const size_t MAX_ENTRIES = 8;
+#else
+    static const size_t POOL_SIZE = 8192;
+    static const size_t MAX_ENTRIES = 32;
+#endif
+    // Hex encoded pool plus the id and JSON overhead per entry
+    static const size_t JSON_SIZE = 2 * POOL_SIZE + MAX_ENTRIES * (ColorFrame::MAX_PALETTE_ID_LENGTH + 32);
+
+    struct Stats
+    {
+        uint32_t hits = 0;
+        uint32_t misses = 0;
+        uint32_t stored = 0;
+        uint32_t evicted = 0;
+    };
+
+    PaletteCache();
+    ~PaletteCache();
+
+    // Remembers a displayed palette under its content hash and its paletteId, if it has one
+    void put(const ColorFrame &frame);
+
+    // Decodes the cached palette into frame, false if it is not cached
+    bool findById(const char *paletteId, ColorFrame &frame);
+    bool findByHash(uint32_t contentHash, ColorFrame &frame);
+
+    size_t size();
+
+    // Set when an entry was added or replaced since the last save()
+    bool isDirty();
+
+    bool save(const char *path);
+    bool restore(const char *path);
+
+    Stats getStats();
+
+private:
+    // Serializes access on the ESP32, no-op on the ESP8266
+    class Lock
+    {
+    public:
+        explicit Lock(PaletteCache &cache);
+        ~Lock();
+
+    private:
+        PaletteCache &cache;
+    };
+
+    int findSlot(const char *paletteId);
+    bool load(int slot, ColorFrame &frame);
+
+#if defined(ESP32)
+    SemaphoreHandle_t mutex;
+#endif
+    BlobCache<POOL_SIZE, MAX_ENTRIES> palettes;
+    char ids[MAX_ENTRIES][ColorFrame::MAX_PALETTE_ID_LENGTH + 1] = {};
+    bool dirty = false;
+    Stats stats;
+};
+
+#endif // PALETTECACHE_H
@@ -0,0 +1,71 @@
+#ifndef PALETTEREPLAYADAPTER_H
+#define PALETTEREPLAYADAPTER_H
+
+#include <functional>
+
+#include "TopicAdapter.h"
+#include "ColorOutput.h"
+#include "PaletteCache.h"
+
+// Shows a cached palette again, selected by {"paletteId": "<id>"} or {"paletteHash": "<8 hex digits>"}.
+// Unknown palettes are reported through the miss callback, so the sender can transmit them in full.
+class PaletteReplayAdapter final : public TopicAdapter {
+public:
+    static const size_t MAX_PAYLOAD_SIZE = 64;
+
+    typedef std::function<void(const JsonObject &request)> MissCallback;
+
+    // frame is only used during callback() and may be shared with the other palette adapters
+    PaletteReplayAdapter(ColorOutput &output, PaletteCache &cache, ColorFrame &frame)
+        : output(&output), cache(cache), topic("color/replay"), frame(frame) {
+    }
+
+    [[nodiscard]] const char *getTopic() const override {
+        return topic;
+    }
+
+    [[nodiscard]] size_t getMaxPayloadSize() const override {
+        return MAX_PAYLOAD_SIZE;
+    }
+
+    JsonDocument &prepareDocument() override {
+        document.clear();
+        return document;
+    }
+
+    void setOutput(ColorOutput &output) {
+        this->output = &output;
+    }
+
+    void setMissCallback(MissCallback callback) {
+        missCallback = callback;
+    }
+
+    void callback(char *topic, const JsonObject &payload, unsigned int length) override {
+        bool found;
+        if (payload["paletteId"].is<const char *>()) {
+            found = cache.findById(payload["paletteId"].as<const char *>(), frame);
+        } else if (payload["paletteHash"].is<const char *>()) {
+            found = cache.findByHash(strtoul(payload["paletteHash"].as<const char *>(), nullptr, 16), frame);
+        } else {
+            Serial.println("Replay without paletteId or paletteHash");
+            return;
+        }
+
+        if (found) {
+            output->setStaticColors(frame);
+        } else if (missCallback) {
+            missCallback(payload);
+        }
+    }
+
+private:
+    ColorOutput *output;
+    PaletteCache &cache;
+    const char *topic;
+    JsonDocument document;
+    MissCallback missCallback;
+    ColorFrame &frame;
+};
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef SSEPARSER_H
+#define SSEPARSER_H
+
+#include <Arduino.h>
+#include <functional>
+
+// Incremental, non-blocking Server-Sent-Events parser. Only the bytes already available on the
+// stream are read into a fixed ring buffer, partial lines are kept across calls. At most
+// MAX_EVENTS_PER_POLL events are dispatched per poll(), the rest stays buffered for the next one,
+// so bursts never stall the caller for long.
+class SseParser
+{
+public:
+    static const size_t RING_SIZE = 1024;          // Read but not yet parsed bytes (power of two)
+    static const size_t MAX_DATA_LENGTH = 1024;    // Longest data payload of one event
+    static const size_t MAX_ID_LENGTH = 16;        // Longest event id
+    static const size_t MAX_FIELD_LENGTH = 8;      // Longest known field name ("data", "id", ...)
+    static const size_t MAX_EVENTS_PER_POLL = 4;   // Events dispatched per poll()
+
+    struct Event
+    {
+        const char *id;
+        const char *data;
+        size_t dataLength;
+    };
+
+    typedef std::function<void(const Event &)> EventCallback;
+
+    void setEventCallback(EventCallback callback);
+
+    // Reads what is available without blocking and dispatches completed events.
+    // Returns the number of dispatched events
+    size_t poll(Stream &stream);
+
+    // Drops buffered bytes and partial events, e.g. after the stream was reopened
+    void reset();
+
+    // Events dropped because their data did not fit
+    uint32_t getDroppedEvents() const;
+
+private:
+    enum ParseState
+    {
+        FIELD,
+        VALUE_START,
+        VALUE,
+        IGNORE
+    };
+
+    enum Target
+    {
+        NONE,
+        ID,
+        DATA
+    };
+
+    size_t fill(Stream &stream);
+    bool parse(uint8_t c);
+    void selectField();
+    void appendValue(char c);
+    bool endLine();
+    bool dispatch();
+
+    uint8_t ring[RING_SIZE];
+    size_t head = 0;
+    size_t tail = 0;
+
+    ParseState state = FIELD;
+    Target target = NONE;
+    char field[MAX_FIELD_LENGTH];
+    size_t fieldLength = 0;
+    bool lastWasCarriageReturn = false;
+
+    char id[MAX_ID_LENGTH + 1] = "";
+    size_t idLength = 0;
+    char data[MAX_DATA_LENGTH + 1];
+    size_t dataLength = 0;
+    bool dataOverflow = false;
+    uint32_t droppedEvents = 0;
+
+    EventCallback eventCallback;
+};
+
+#endif // SSEPARSER_H
@@ -9,7 +9,19 @@ public:
 
     [[nodiscard]] virtual const char *getTopic() const = 0;
 
+    // Larger payloads are rejected before they are parsed
+    [[nodiscard]] virtual size_t getMaxPayloadSize() const = 0;
+
+    // Empty document the next payload is parsed into, owned and reused by the adapter
+    virtual JsonDocument &prepareDocument() = 0;
+
     virtual void callback(char *topic, const JsonObject &payload, unsigned int length) = 0;
+
+    // Sees the payload before it is parsed as JSON. Adapters for binary payloads handle it here
+    // and return true, the JSON path is skipped then
+    virtual bool handleRaw(char *topic, const uint8_t *payload, unsigned int length) {
+        return false;
+    }
 };
 
 #endif
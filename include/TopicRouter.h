@@ -0,0 +1,58 @@
+#ifndef TOPICROUTER_H
+#define TOPICROUTER_H
+
+#include <Arduino.h>
+#include <vector>
+
+#include "TopicAdapter.h"
+
+// Dispatch table from MQTT topic filters to adapters. Filters are split into pre-hashed
+// segments once when they are added, routing a received topic allocates nothing.
+// Wildcards follow the MQTT spec: '+' matches exactly one level, a trailing '#' matches the
+// parent level and everything below it, and neither matches topics starting with '$'.
+class TopicRouter
+{
+public:
+    static const size_t MAX_SEGMENTS = 16;
+
+    bool add(const String &filter, TopicAdapter *adapter);
+
+    // First adapter whose filter matches the topic, nullptr if none
+    TopicAdapter *route(const char *topic) const;
+
+    size_t size() const;
+
+    const String &getFilter(size_t index) const;
+
+private:
+    enum SegmentType : uint8_t
+    {
+        LITERAL,
+        SINGLE_LEVEL, // +
+        MULTI_LEVEL   // #
+    };
+
+    struct Segment
+    {
+        uint32_t hash;
+        uint16_t offset;
+        uint16_t length;
+        SegmentType type;
+    };
+
+    struct Route
+    {
+        String filter;
+        TopicAdapter *adapter;
+        Segment segments[MAX_SEGMENTS];
+        size_t segmentCount;
+    };
+
+    static uint32_t hash(const char *text, size_t length);
+
+    static bool matches(const Route &route, const char *topic, const Segment *segments, size_t segmentCount);
+
+    std::vector<Route> routes;
+};
+
+#endif // TOPICROUTER_H
@@ -0,0 +1,54 @@
+#ifndef WRITEPACER_H
+#define WRITEPACER_H
+
+#include <Arduino.h>
+
+// Adapts the minimum interval between writes to one device (AIMD). Every fast, successful write
+// shortens the interval a little, a failed or noticeably slowed down write doubles it. This keeps
+// the write rate just below the point where the panels start to queue up or drop requests.
+// The fastest RTT is taken over the last MIN_RTT_WINDOW to 2 * MIN_RTT_WINDOW writes, so one
+// unusually fast write does not make every normal one look slow forever.
+class WritePacer
+{
+public:
+    static const unsigned long MIN_INTERVAL = 50;       // Fastest pacing (in ms)
+    static const unsigned long MAX_INTERVAL = 5000;     // Slowest pacing (in ms)
+    static const unsigned long INITIAL_INTERVAL = 250;  // Pacing before the first measurement (in ms)
+    static const unsigned long INTERVAL_STEP = 10;      // Additive decrease per good write (in ms)
+    static const unsigned long RTT_SLACK = 50;          // Tolerated RTT above twice the fastest one (in ms)
+    static const uint32_t MIN_RTT_WINDOW = 32;          // Successful writes after which the fastest RTT is re-measured
+
+    struct Stats
+    {
+        uint32_t writes = 0;
+        uint32_t failures = 0;
+        uint32_t backoffs = 0;
+        unsigned long interval = INITIAL_INTERVAL;
+        unsigned long smoothedRtt = 0;
+        unsigned long minRtt = 0;
+    };
+
+    // Time left until the next write should start, 0 if it may start now
+    unsigned long getWriteDelay(unsigned long now) const;
+
+    void onWriteStarted(unsigned long now);
+
+    // The request is on the wire, the RTT is measured from here
+    void onRequestSent(unsigned long now);
+
+    void onWriteFinished(unsigned long now, bool success);
+
+    const Stats &getStats() const;
+
+private:
+    void backOff();
+
+    Stats stats;
+    unsigned long lastWriteStartedAt = 0;
+    unsigned long requestSentAt = 0;
+    unsigned long windowMinRtt = 0; // Fastest RTT of the current window
+    uint32_t windowWrites = 0;
+    bool written = false;
+};
+
+#endif // WRITEPACER_H
@@ -0,0 +1,150 @@
+#include "AnimDataEncoder.h"
+#include <new>
+
+namespace
+{
+    const char BODY_HEAD[] = R"({"write":{"command":"display","version":"2.0","animType":"custom","animData":")";
+    const char BODY_TAIL[] = R"(","loop":false,"palette":[{"hue":0}]}})";
+
+    // Two digits per lookup instead of one division per digit
+    const char DIGIT_PAIRS[] =
+        "00010203040506070809"
+        "10111213141516171819"
+        "20212223242526272829"
+        "30313233343536373839"
+        "40414243444546474849"
+        "50515253545556575859"
+        "60616263646566676869"
+        "70717273747576777879"
+        "80818283848586878889"
+        "90919293949596979899";
+}
+
+bool AnimDataEncoder::begin(const size_t maxEntries)
+{
+    const size_t required = FRAME_LENGTH + maxEntries * MAX_ENTRY_LENGTH;
+    if (required > capacity)
+    {
+        buffer.reset();
+        capacity = 0;
+        buffer.reset(new (std::nothrow) char[required]);
+        if (!buffer)
+        {
+            Serial.printf("No memory for an effect body of %u entries\n", static_cast<unsigned>(maxEntries));
+            return false;
+        }
+        capacity = required;
+    }
+
+    position = 0;
+    tiles = 0;
+    overflow = false;
+    append(BODY_HEAD, sizeof(BODY_HEAD) - 1);
+    countPosition = position;
+    return true;
+}
+
+void AnimDataEncoder::append(const char *text, const size_t length)
+{
+    if (overflow || position + length > capacity)
+    {
+        overflow = true;
+        return;
+    }
+    memcpy(buffer.get() + position, text, length);
+    position += length;
+}
+
+void AnimDataEncoder::appendUInt(uint32_t value)
+{
+    char digits[10];
+    size_t start = sizeof(digits);
+
+    while (value >= 100)
+    {
+        const uint32_t pair = (value % 100) * 2;
+        value /= 100;
+        digits[--start] = DIGIT_PAIRS[pair + 1];
+        digits[--start] = DIGIT_PAIRS[pair];
+    }
+    if (value >= 10)
+    {
+        digits[--start] = DIGIT_PAIRS[value * 2 + 1];
+        digits[--start] = DIGIT_PAIRS[value * 2];
+    }
+    else
+    {
+        digits[--start] = static_cast<char>('0' + value);
+    }
+
+    append(digits + start, sizeof(digits) - start);
+}
+
+void AnimDataEncoder::beginEntry(const uint16_t tileId)
+{
+    append(" ", 1);
+    appendUInt(tileId);
+    append(" 2 ", 3);
+    tiles++;
+}
+
+bool AnimDataEncoder::addTile(const uint16_t tileId, const uint8_t r, const uint8_t g, const uint8_t b)
+{
+    beginEntry(tileId);
+
+    append("0 0 0 0 30 ", 11);
+    appendUInt(r);
+    append(" ", 1);
+    appendUInt(g);
+    append(" ", 1);
+    appendUInt(b);
+    append(" 0 50", 5);
+    return !overflow;
+}
+
+bool AnimDataEncoder::addTriangle(const uint16_t tileId, const uint8_t r, const uint8_t g, const uint8_t b)
+{
+    beginEntry(tileId);
+
+    appendUInt(r);
+    append(" ", 1);
+    appendUInt(g);
+    append(" ", 1);
+    appendUInt(b);
+    append(" 0 3600 0 0 0 0 360", 19);
+    return !overflow;
+}
+
+bool AnimDataEncoder::finish()
+{
+    // The tile count leads the animData but is only known now, so the entries are shifted behind it
+    char count[6];
+    const size_t countLength = snprintf(count, sizeof(count), "%u", static_cast<unsigned>(tiles));
+    if (overflow || position + countLength + sizeof(BODY_TAIL) - 1 > capacity)
+    {
+        overflow = true;
+        return false;
+    }
+
+    memmove(buffer.get() + countPosition + countLength, buffer.get() + countPosition, position - countPosition);
+    memcpy(buffer.get() + countPosition, count, countLength);
+    position += countLength;
+
+    append(BODY_TAIL, sizeof(BODY_TAIL) - 1);
+    return !overflow;
+}
+
+const char *AnimDataEncoder::data() const
+{
+    return buffer.get();
+}
+
+size_t AnimDataEncoder::length() const
+{
+    return position;
+}
+
+size_t AnimDataEncoder::tileCount() const
+{
+    return tiles;
+}
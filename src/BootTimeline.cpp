@@ -0,0 +1,93 @@
+#include "BootTimeline.h"
+
+void BootTimeline::start(const Phase phase)
+{
+    Entry &entry = entries[phase];
+    if (!entry.started)
+    {
+        entry.startedAt = millis();
+        entry.started = true;
+    }
+}
+
+void BootTimeline::finish(const Phase phase)
+{
+    Entry &entry = entries[phase];
+    if (entry.finished)
+    {
+        return;
+    }
+    start(phase);
+    entry.finishedAt = millis();
+    entry.finished = true;
+    Serial.printf("Boot phase %s finished after %lu ms (at %lu ms)\n", getName(phase),
+                  entry.finishedAt - entry.startedAt, entry.finishedAt);
+}
+
+bool BootTimeline::isStarted(const Phase phase) const
+{
+    return entries[phase].started;
+}
+
+bool BootTimeline::isFinished(const Phase phase) const
+{
+    return entries[phase].finished;
+}
+
+void BootTimeline::toJson(JsonObject phases) const
+{
+    for (int phase = 0; phase < PHASE_COUNT; phase++)
+    {
+        const Entry &entry = entries[phase];
+        if (!entry.started)
+        {
+            continue;
+        }
+        JsonObject timing = phases[getName(static_cast<Phase>(phase))].to<JsonObject>();
+        timing["start"] = entry.startedAt;
+        if (entry.finished)
+        {
+            timing["end"] = entry.finishedAt;
+        }
+    }
+}
+
+void BootTimeline::printTo(Print &out) const
+{
+    for (int phase = 0; phase < PHASE_COUNT; phase++)
+    {
+        const Entry &entry = entries[phase];
+        if (entry.finished)
+        {
+            out.printf("  %-12s %6lu - %6lu ms\n", getName(static_cast<Phase>(phase)), entry.startedAt,
+                       entry.finishedAt);
+        }
+        else if (entry.started)
+        {
+            out.printf("  %-12s %6lu - pending\n", getName(static_cast<Phase>(phase)), entry.startedAt);
+        }
+    }
+}
+
+const char *BootTimeline::getName(const Phase phase)
+{
+    switch (phase)
+    {
+    case CONFIG:
+        return "config";
+    case WIFI:
+        return "wifi";
+    case MQTT:
+        return "mqtt";
+    case DISCOVERY:
+        return "discovery";
+    case NANOLEAF:
+        return "nanoleaf";
+    case COLOR_READY:
+        return "colorReady";
+    case STATUS:
+        return "status";
+    default:
+        return "unknown";
+    }
+}
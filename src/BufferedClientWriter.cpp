@@ -0,0 +1,43 @@
+#include "BufferedClientWriter.h"
+
+BufferedClientWriter::BufferedClientWriter(Print &client)
+    : client(client)
+{
+}
+
+bool BufferedClientWriter::flushChunk()
+{
+    if (used > 0 && !failed)
+    {
+        failed = client.write(chunk, used) != used;
+    }
+    used = 0;
+    return !failed;
+}
+
+size_t BufferedClientWriter::write(const uint8_t c)
+{
+    if (used == CHUNK_SIZE && !flushChunk())
+    {
+        return 0;
+    }
+    chunk[used++] = c;
+    return 1;
+}
+
+size_t BufferedClientWriter::write(const uint8_t *buffer, const size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        if (write(buffer[i]) == 0)
+        {
+            return i;
+        }
+    }
+    return size;
+}
+
+bool BufferedClientWriter::finish()
+{
+    return flushChunk();
+}
@@ -0,0 +1,117 @@
+#include "ColorPipeline.h"
+
+#if defined(ESP32)
+namespace
+{
+    const uint32_t OUTPUT_TASK_STACK_SIZE = 8192;
+    const UBaseType_t OUTPUT_TASK_PRIORITY = 1;
+    const BaseType_t OUTPUT_TASK_CORE = 0; // Arduino loop() runs on core 1
+}
+#endif
+
+ColorPipeline::ColorPipeline(ColorOutput &output)
+    : output(&output)
+{
+}
+
+void ColorPipeline::begin()
+{
+#if defined(ESP32)
+    if (outputTaskHandle == nullptr)
+    {
+        xTaskCreatePinnedToCore(outputTask, "color-output", OUTPUT_TASK_STACK_SIZE, this, OUTPUT_TASK_PRIORITY,
+                                &outputTaskHandle, OUTPUT_TASK_CORE);
+    }
+#endif
+}
+
+void ColorPipeline::setOutput(ColorOutput &output)
+{
+    this->output = &output;
+}
+
+void ColorPipeline::setWrittenCallback(WrittenCallback callback)
+{
+    writtenCallback = callback;
+}
+
+bool ColorPipeline::setStaticColors(const ColorFrame &frame)
+{
+    received++;
+    if (!mailbox.post(frame))
+    {
+        coalesced++;
+    }
+
+#if defined(ESP32)
+    if (outputTaskHandle != nullptr)
+    {
+        xTaskNotifyGive(outputTaskHandle);
+    }
+#endif
+    return true;
+}
+
+void ColorPipeline::writePending()
+{
+    const ColorFrame *frame = mailbox.take();
+    if (frame != nullptr)
+    {
+        if (!output->setStaticColors(*frame))
+        {
+            failed++;
+            return;
+        }
+        written++;
+        if (writtenCallback)
+        {
+            writtenCallback(*frame);
+        }
+    }
+}
+
+void ColorPipeline::pump()
+{
+#if defined(ESP32)
+    if (outputTaskHandle != nullptr)
+    {
+        return;
+    }
+#endif
+    if (output->getWriteDelay() == 0)
+    {
+        writePending();
+    }
+}
+
+#if defined(ESP32)
+void ColorPipeline::outputTask(void *parameter)
+{
+    ColorPipeline *pipeline = static_cast<ColorPipeline *>(parameter);
+    while (true)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        // Frames arriving while the output is paced replace the pending one
+        unsigned long writeDelay;
+        while ((writeDelay = pipeline->output->getWriteDelay()) > 0)
+        {
+            vTaskDelay(pdMS_TO_TICKS(writeDelay));
+        }
+
+        // Frames posted during the write are picked up by the next iteration, the
+        // notification count was already raised for them
+        pipeline->writePending();
+    }
+}
+#endif
+
+ColorPipeline::Stats ColorPipeline::getStats() const
+{
+    Stats stats;
+    stats.received = received;
+    stats.coalesced = coalesced;
+    stats.written = written;
+    stats.failed = failed;
+    return stats;
+}
@@ -3,19 +3,51 @@
 // Global Variables
 WiFiManager wifiManager;
 WiFiClient wifiClientForMQTT;
-WiFiClient wifiClientForHTTP;
-HTTPClient httpClient;
 MQTTClient mqttClient(wifiClientForMQTT);
-NanoleafApiWrapper nanoleaf(wifiClientForMQTT);
-ColorPaletteAdapter colorPaletteAdapter(nanoleaf);
+HttpConnectionManager nanoleafConnections(NANOLEAF_HTTP_TIMEOUT);
+HttpConnectionManager backendConnections(BACKEND_HTTP_TIMEOUT);
+NanoleafApiWrapper nanoleaf(nanoleafConnections);
+WiFiUDP nanoleafUdp;
+NanoleafRegistry nanoleafs(nanoleaf, nanoleafConnections);
+ColorPipeline colorPipeline(nanoleafs);
+ColorFrame decodedPalette; // Shared by the palette adapters, MQTT callbacks never overlap
+ColorPaletteAdapter colorPaletteAdapter(colorPipeline, decodedPalette);
+PackedPaletteAdapter packedPaletteAdapter(colorPipeline, decodedPalette);
+PaletteCache paletteCache;
+PaletteReplayAdapter paletteReplayAdapter(colorPipeline, paletteCache, decodedPalette);
+CooperativeScheduler scheduler;
+BootTimeline bootTimeline;
+NanoleafDiscovery nanoleafDiscovery;
 
 // Wi-Fi credentials
 char ssid[32];     // Wifi SSID
 char password[64]; // Wifi Password
 
+// Last access point and IP configuration, skips the scan and DHCP on the next boot
+uint8_t wifiBssid[6];
+int32_t wifiChannel = 0; // 0 if no lease is cached
+IPAddress wifiIp;
+IPAddress wifiGateway;
+IPAddress wifiSubnet;
+IPAddress wifiDns;
+
 // NanoLeaf Vars
 char nanoleafBaseUrl[55] = "";   // NanoLeaf Baseurl (http://<ip>:<port>)
 char nanoleafAuthToken[33] = ""; // Nanoleaf Auth Token
+char nanoleafDeviceId[24] = "";  // Nanoleaf Device ID (mDNS "id" TXT record), picks the device if several answer
+bool nanoleafConnectionFailed = false;
+unsigned long nanoleafConnectionFailedAt = 0;
+bool nanoleafConnectionLost = false; // Set by the heartbeat, a reconnect that fails then restarts the ESP
+
+// Additional Nanoleafs, paired during the initial setup and driven together with the first one
+struct AdditionalNanoleaf
+{
+    char baseUrl[55];
+    char authToken[33];
+    char deviceId[24];
+};
+AdditionalNanoleaf additionalNanoleafs[NanoleafRegistry::MAX_DEVICES - 1];
+size_t additionalNanoleafCount = 0;
 
 // Setup Vars
 char friendId[36] = "";
@@ -23,12 +55,33 @@ char name[36] = "";
 char groupId[36] = "";
 
 // Flags and Timers
-unsigned long lastPublishTime = 0;
 bool shouldSaveConfig = false;
 bool layoutChanged = false;
+bool eventStreamInterrupted = false; // Set while the event stream is down after it was open
 bool initialSetupDone = false;
-unsigned long lastColorTime = 0;
+bool initialStatusPublished = false;
+
+// Last layout accepted by the backend, later status updates only send the difference
+std::vector<String> publishedTileIds;
+uint32_t publishedLayoutHash = 0;
+bool statusPublished = false;
+bool backendSupportsDeltas = false; // The backend echoed the layoutHash, so it understands deltas
+bool statusRefreshPending = false;  // Set on MQTT (re)connects, the full status is sent from loop()
+bool bootTimingsPublished = false;
 bool currentlyShowingCustomColor = false;
+std::atomic<bool> colorWritten(false); // Set by the color output, which may run on the other core
+
+// Scheduled Tasks
+CooperativeScheduler::TaskId heartbeatTask;
+CooperativeScheduler::TaskId idlePowerOffTask;
+CooperativeScheduler::TaskId nanoleafConnectTask;
+CooperativeScheduler::TaskId eventRegistrationTask;
+CooperativeScheduler::TaskId nanoleafDiscoveryTask;
+CooperativeScheduler::TaskId setupConfirmationTask;
+CooperativeScheduler::TaskId paletteCacheSaveTask;
+CooperativeScheduler::TaskId wifiDhcpHandoverTask;
+CooperativeScheduler::TaskId statusRefreshTask;
+CooperativeScheduler::TaskId wifiLeaseRefreshTask;
 
 // Reset Logic
 #define RESET_BTN_PIN 0      // Flash Button Pin
@@ -48,6 +101,12 @@ void performReset()
 {
     wifiManager.erase();
     FileSystemHandler::removeConfigFile(CONFIG_FILE);
+    FileSystemHandler::removeConfigFile(LAYOUT_FILE);
+    for (const char *layoutFile : ADDITIONAL_LAYOUT_FILES)
+    {
+        FileSystemHandler::removeConfigFile(layoutFile);
+    }
+    FileSystemHandler::removeConfigFile(PALETTE_CACHE_FILE);
     ESP.restart();
 }
 
@@ -75,6 +134,11 @@ void connectToWifi(bool useSavedCredentials)
         return;
     }
 
+    if (connectToWifiWithCachedLease())
+    {
+        return;
+    }
+
     Serial.println("Connecting to Wi-Fi using saved credentials...");
     WiFi.begin(ssid, password);
 
@@ -91,6 +155,7 @@ void connectToWifi(bool useSavedCredentials)
     if (WiFi.status() == WL_CONNECTED)
     {
         Serial.println("\nConnected to Wi-Fi");
+        updateWifiLease();
     }
     else
     {
@@ -99,6 +164,132 @@ void connectToWifi(bool useSavedCredentials)
     }
 }
 
+// Directed connect to the last access point with the last IP configuration, no scan and no DHCP
+// Only after a soft reset the DHCP server is known to still hold the cached lease. After a power cut
+// the lease may have run out and the address been given to another host
+bool wasSoftReset()
+{
+#if defined(ESP8266)
+    const uint32_t reason = ESP.getResetInfoPtr()->reason;
+    return reason == REASON_SOFT_RESTART || reason == REASON_EXCEPTION_RST || reason == REASON_SOFT_WDT_RST ||
+           reason == REASON_WDT_RST;
+#else
+    const esp_reset_reason_t reason = esp_reset_reason();
+    return reason == ESP_RST_SW || reason == ESP_RST_PANIC || reason == ESP_RST_INT_WDT ||
+           reason == ESP_RST_TASK_WDT || reason == ESP_RST_WDT;
+#endif
+}
+
+bool connectToWifiWithCachedLease()
+{
+    if (wifiChannel == 0)
+    {
+        return false;
+    }
+
+    // The access point is always reused, the address only while the lease is known to be ours
+    const bool reuseAddress = wasSoftReset();
+    if (reuseAddress)
+    {
+        Serial.println("Connecting to Wi-Fi using the cached lease...");
+        WiFi.config(wifiIp, wifiGateway, wifiSubnet, wifiDns);
+    }
+    else
+    {
+        Serial.println("Connecting to Wi-Fi using the cached access point...");
+    }
+    WiFi.begin(ssid, password, wifiChannel, wifiBssid);
+
+    const unsigned long timeout = reuseAddress ? WIFI_FAST_CONNECT_TIMEOUT : WIFI_CONNECT_TIMEOUT;
+    unsigned long startAttemptTime = millis();
+    while (WiFi.status() != WL_CONNECTED && (millis() - startAttemptTime) < timeout)
+    {
+        delay(WIFI_FAST_POLL_INTERVAL);
+    }
+
+    if (WiFi.status() == WL_CONNECTED)
+    {
+        Serial.printf("Connected to Wi-Fi in %lu ms\n", millis() - startAttemptTime);
+        if (reuseAddress)
+        {
+            // A static address is never renewed, DHCP takes over once the boot is done
+            scheduler.start(wifiDhcpHandoverTask, WIFI_DHCP_HANDOVER_DELAY);
+        }
+        else
+        {
+            updateWifiLease();
+        }
+        return true;
+    }
+
+    // The access point or the network changed, scan and use DHCP again. The new lease is saved then
+    Serial.println("Cached lease failed, falling back to a full scan.");
+    WiFi.disconnect();
+    WiFi.config(IPAddress(0, 0, 0, 0), IPAddress(0, 0, 0, 0), IPAddress(0, 0, 0, 0));
+    wifiChannel = 0;
+    return false;
+}
+
+// Renews the reused lease via DHCP. Usually the server confirms the same address, otherwise the
+// sockets opened since the boot are bound to an address that is gone and are reopened
+void handOverWifiToDhcp()
+{
+    Serial.println("Handing the Wi-Fi address over to DHCP");
+    WiFi.config(IPAddress(0, 0, 0, 0), IPAddress(0, 0, 0, 0), IPAddress(0, 0, 0, 0));
+    scheduler.start(wifiLeaseRefreshTask, WIFI_LEASE_REFRESH_DELAY);
+}
+
+void finishDhcpHandover()
+{
+    const IPAddress previousIp = wifiIp;
+    updateWifiLease();
+    if (WiFi.status() != WL_CONNECTED || WiFi.localIP() == previousIp)
+    {
+        return;
+    }
+
+    Serial.printf("DHCP assigned %s, reopening the connections\n", WiFi.localIP().toString().c_str());
+    mqttClient.disconnect();
+    nanoleafConnections.stopIdle();
+    backendConnections.stopIdle();
+    for (size_t i = 0; i < nanoleafs.size(); i++)
+    {
+        nanoleafs.get(i).closeEvents();
+    }
+    // Layout events may have been missed meanwhile
+    onEventStreamLost();
+}
+
+void updateWifiLease()
+{
+    const uint8_t *bssid = WiFi.BSSID();
+    if (WiFi.status() != WL_CONNECTED || bssid == nullptr)
+    {
+        return;
+    }
+
+    const bool changed = wifiChannel != WiFi.channel() || memcmp(wifiBssid, bssid, sizeof(wifiBssid)) != 0 ||
+                         wifiIp != WiFi.localIP() || wifiGateway != WiFi.gatewayIP() ||
+                         wifiSubnet != WiFi.subnetMask() || wifiDns != WiFi.dnsIP();
+    if (!changed)
+    {
+        return;
+    }
+
+    memcpy(wifiBssid, bssid, sizeof(wifiBssid));
+    wifiChannel = WiFi.channel();
+    wifiIp = WiFi.localIP();
+    wifiGateway = WiFi.gatewayIP();
+    wifiSubnet = WiFi.subnetMask();
+    wifiDns = WiFi.dnsIP();
+
+    // Before the initial setup is done the whole config is saved at its end
+    if (initialSetupDone)
+    {
+        saveConfigToFile();
+    }
+}
+
 void setupWiFiManager()
 {
     wifiManager.setDebugOutput(true); // Disable the debug output to keep Serial clean
@@ -124,6 +315,8 @@ void setupWiFiManager()
 
     strncpy(ssid, WiFi.SSID().c_str(), sizeof(ssid) - 1);
     strncpy(password, WiFi.psk().c_str(), sizeof(password) - 1);
+    // Cached together with the credentials it belongs to
+    updateWifiLease();
     strncpy(groupId, customGroupId.getValue(), sizeof(groupId) - 1);
     strncpy(name, customName.getValue(), sizeof(name) - 1);
     strncpy(friendId, customFriendId.getValue(), sizeof(friendId) - 1);
@@ -152,55 +345,108 @@ void generateShortUUID(char *uuid, size_t length)
     uuid[length - 1] = '\0';
 }
 
-bool generateMDNSNanoleafURL()
+// Takes the address of this controller's Nanoleaf from the discovery cache
+bool useDiscoveredNanoleaf()
 {
-    if (MDNS.begin("esp8266"))
+    const NanoleafDiscovery::Device *device = nanoleafDiscovery.select(nanoleafDeviceId, nanoleafBaseUrl);
+    if (device == nullptr)
     {
-        Serial.println("MDNS wurde gestartet.");
+        return false;
+    }
 
-        int retryCount = 0;
-        int retryDelay = MDNS_INITIAL_RETRY_DELAY;
+    char url[sizeof(nanoleafBaseUrl)];
+    NanoleafDiscovery::buildBaseUrl(*device, url, sizeof(url));
+    // The address that just failed is only used again once a newer answer confirmed it
+    if (nanoleafConnectionFailed && strcmp(url, nanoleafBaseUrl) == 0 &&
+        static_cast<long>(device->seenAt - nanoleafConnectionFailedAt) < 0)
+    {
+        return false;
+    }
 
-        while (retryCount < MDNS_MAX_RETRIES)
-        {
-            Serial.printf("Versuch %d den Nanoleaf Service zu finden...\n", retryCount + 1);
-            int n = MDNS.queryService("nanoleafapi", "tcp");
+    strncpy(nanoleafBaseUrl, url, sizeof(nanoleafBaseUrl) - 1);
+    if (strlen(nanoleafDeviceId) == 0)
+    {
+        strncpy(nanoleafDeviceId, device->id, sizeof(nanoleafDeviceId) - 1);
+    }
+    Serial.printf("Nanoleaf Service wurde gefunden: %s\n", nanoleafBaseUrl);
+    saveConfigToFile();
+    return true;
+}
 
-            if (n > 0)
-            {
-                String ip = MDNS.IP(0).toString();
-                int port = MDNS.port(0);
+// Blocking lookup with retries, only used during the initial setup
+bool generateMDNSNanoleafURL()
+{
+    if (!nanoleafDiscovery.begin("esp8266"))
+    {
+        return false;
+    }
 
-                snprintf(nanoleafBaseUrl, sizeof(nanoleafBaseUrl), "http://%s:%d", ip.c_str(), port);
-                Serial.printf("Nanoleaf Service wurde gefunden: %s\n", nanoleafBaseUrl);
-                saveConfigToFile();
-                return true;
-            }
-            else
-            {
-                Serial.println("Es wurde kein Nanoleaf Service gefunden. Neuer Versuch...");
-                retryCount++;
-                delay(retryDelay);
+    int retryDelay = MDNS_INITIAL_RETRY_DELAY;
+    for (int retryCount = 0; retryCount < MDNS_MAX_RETRIES; retryCount++)
+    {
+        Serial.printf("Versuch %d den Nanoleaf Service zu finden...\n", retryCount + 1);
+        nanoleafDiscovery.startQuery();
+        while (nanoleafDiscovery.isQueryRunning())
+        {
+            nanoleafDiscovery.loop();
+            delay(10);
+        }
+        if (useDiscoveredNanoleaf())
+        {
+            return true;
+        }
 
-                // Exponential Backoff
-                retryDelay = static_cast<int>(retryDelay * MDNS_BACKOFF_FACTOR);
-                if (retryDelay > MDNS_INITIAL_RETRY_DELAY * 10)
-                {
-                    retryDelay = MDNS_INITIAL_RETRY_DELAY * 10; // Cap the delay to a max of a factor of 10
-                }
-            }
+        Serial.println("Es wurde kein Nanoleaf Service gefunden. Neuer Versuch...");
+        delay(retryDelay);
+
+        // Exponential Backoff
+        retryDelay = static_cast<int>(retryDelay * MDNS_BACKOFF_FACTOR);
+        if (retryDelay > MDNS_INITIAL_RETRY_DELAY * 10)
+        {
+            retryDelay = MDNS_INITIAL_RETRY_DELAY * 10; // Cap the delay to a max of a factor of 10
         }
+    }
 
-        // If we exit the loop without finding a service
-        Serial.println("Es konnte kein Nanoleaf Service nach der maximalen Anzahl an Versuchen gefunden werden.");
+    // If we exit the loop without finding a service
+    Serial.println("Es konnte kein Nanoleaf Service nach der maximalen Anzahl an Versuchen gefunden werden.");
+    return false;
+}
+
+void onNanoleafDiscovered()
+{
+    scheduler.stop(nanoleafDiscoveryTask);
+    bootTimeline.finish(BootTimeline::DISCOVERY);
+    attemptNanoleafConnection();
+}
+
+// A cached answer is used right away, otherwise a query runs in the background
+bool tryNanoleafDiscovery()
+{
+    if (useDiscoveredNanoleaf())
+    {
+        onNanoleafDiscovered();
+        return true;
     }
-    else
+
+    Serial.printf("Versuch %u den Nanoleaf Service zu finden...\n", scheduler.getAttempts(nanoleafDiscoveryTask));
+    if (nanoleafDiscovery.begin("esp8266"))
     {
-        Serial.println("Fehler beim Starten von MNDS.");
+        nanoleafDiscovery.startQuery();
     }
     return false;
 }
 
+// Continues the discovery as soon as the query has the answer instead of at the next attempt
+void onNanoleafQueryFinished()
+{
+    updateAdditionalNanoleafAddresses();
+
+    if (scheduler.isActive(nanoleafDiscoveryTask) && useDiscoveredNanoleaf())
+    {
+        onNanoleafDiscovered();
+    }
+}
+
 void loadConfigFromFile()
 {
     JsonDocument jsonConfig;
@@ -215,9 +461,36 @@ void loadConfigFromFile()
     strncpy(name, jsonConfig["name"], sizeof(name) - 1);
     strncpy(groupId, jsonConfig["groupId"], sizeof(groupId) - 1);
     strncpy(nanoleafBaseUrl, jsonConfig["nanoleafBaseUrl"], sizeof(nanoleafBaseUrl) - 1);
+    strncpy(nanoleafDeviceId, jsonConfig["nanoleafDeviceId"] | "", sizeof(nanoleafDeviceId) - 1);
+
+    additionalNanoleafCount = 0;
+    for (JsonObject device : jsonConfig["additionalNanoleafs"].as<JsonArray>())
+    {
+        if (additionalNanoleafCount == NanoleafRegistry::MAX_DEVICES - 1)
+        {
+            break;
+        }
+        AdditionalNanoleaf &additional = additionalNanoleafs[additionalNanoleafCount++];
+        strncpy(additional.baseUrl, device["baseUrl"] | "", sizeof(additional.baseUrl) - 1);
+        strncpy(additional.authToken, device["authToken"] | "", sizeof(additional.authToken) - 1);
+        strncpy(additional.deviceId, device["deviceId"] | "", sizeof(additional.deviceId) - 1);
+    }
     strncpy(friendId, jsonConfig["friendId"], sizeof(friendId) - 1);
     initialSetupDone = jsonConfig["setupDone"];
 
+    JsonArray bssid = jsonConfig["wifiBssid"];
+    if (bssid.size() == sizeof(wifiBssid) && wifiIp.fromString(jsonConfig["wifiIp"].as<String>()) &&
+        wifiGateway.fromString(jsonConfig["wifiGateway"].as<String>()) &&
+        wifiSubnet.fromString(jsonConfig["wifiSubnet"].as<String>()) &&
+        wifiDns.fromString(jsonConfig["wifiDns"].as<String>()))
+    {
+        for (size_t i = 0; i < sizeof(wifiBssid); i++)
+        {
+            wifiBssid[i] = bssid[i];
+        }
+        wifiChannel = jsonConfig["wifiChannel"];
+    }
+
     Serial.println("Parsed JSON config");
 }
 
@@ -230,8 +503,33 @@ void saveConfigToFile()
     jsonConfig["friendId"] = friendId;
     jsonConfig["name"] = name;
     jsonConfig["nanoleafBaseUrl"] = nanoleafBaseUrl;
+    jsonConfig["nanoleafDeviceId"] = nanoleafDeviceId;
+    if (additionalNanoleafCount > 0)
+    {
+        JsonArray devices = jsonConfig["additionalNanoleafs"].to<JsonArray>();
+        for (size_t i = 0; i < additionalNanoleafCount; i++)
+        {
+            JsonObject device = devices.add<JsonObject>();
+            device["baseUrl"] = additionalNanoleafs[i].baseUrl;
+            device["authToken"] = additionalNanoleafs[i].authToken;
+            device["deviceId"] = additionalNanoleafs[i].deviceId;
+        }
+    }
     jsonConfig["groupId"] = groupId;
     jsonConfig["setupDone"] = initialSetupDone;
+    if (wifiChannel != 0)
+    {
+        JsonArray bssid = jsonConfig["wifiBssid"].to<JsonArray>();
+        for (uint8_t octet : wifiBssid)
+        {
+            bssid.add(octet);
+        }
+        jsonConfig["wifiChannel"] = wifiChannel;
+        jsonConfig["wifiIp"] = wifiIp.toString();
+        jsonConfig["wifiGateway"] = wifiGateway.toString();
+        jsonConfig["wifiSubnet"] = wifiSubnet.toString();
+        jsonConfig["wifiDns"] = wifiDns.toString();
+    }
     shouldSaveConfig = false;
 
     if (!FileSystemHandler::saveConfigToFile(CONFIG_FILE, jsonConfig))
@@ -250,116 +548,325 @@ void generateNanoleafToken()
     }
 }
 
-void attemptNanoleafConnection()
+void onNanoleafConnected()
 {
-    nanoleaf.setup(nanoleafBaseUrl, nanoleafAuthToken);
-    int attempts = 0;
-    const int maxAttempts = 5;
+    Serial.println("Nanoleaf connected");
+    nanoleafConnectionFailed = false;
+    if (nanoleafConnectionLost)
+    {
+        Serial.println("Reconnecting worked! Continuing as before.");
+        nanoleafConnectionLost = false;
+    }
+    bootTimeline.finish(BootTimeline::NANOLEAF);
+    scheduler.start(eventRegistrationTask);
 
-    while (!nanoleaf.isConnected() && attempts < maxAttempts)
+    // On every connect, the panels forget extControl when they restart
+    if (USE_UDP_STREAMING && !nanoleafs.beginStreaming(nanoleafUdp, colorCallback))
     {
-        Serial.printf("Attempting Nanoleaf connection... (%d/%d)\n", attempts + 1, maxAttempts);
-        delay(6000);
+        Serial.println("Failed to start UDP streaming, falling back to HTTP.");
+    }
 
-        if (!nanoleaf.isConnected())
-        {
-            generateNanoleafToken();
-        }
-        attempts++;
+    if (!initialStatusPublished)
+    {
+        bootTimeline.start(BootTimeline::STATUS);
+        publishStatus();
+        publishInitialHeartbeat();
+        initialStatusPublished = true;
+        bootTimeline.finish(BootTimeline::STATUS);
     }
+}
 
+bool tryNanoleafConnection()
+{
     if (nanoleaf.isConnected())
     {
-        Serial.println("Nanoleaf connected");
-        registerNanoleafEvents();
+        // Marks the reconnect as done, otherwise the initial heartbeat would be skipped
+        scheduler.stop(nanoleafConnectTask);
+        onNanoleafConnected();
+        return true;
     }
-    else
+
+    Serial.printf("Attempting Nanoleaf connection... (%u/%u)\n", scheduler.getAttempts(nanoleafConnectTask),
+                  NANOLEAF_CONNECT_RETRY.maxAttempts);
+    generateNanoleafToken();
+    return false;
+}
+
+void onNanoleafConnectionFailed()
+{
+    if (nanoleafConnectionLost)
     {
-        Serial.println("Failed to connect to Nanoleaf with saved baseURL, reattempting MDNS lookup.");
-        generateMDNSNanoleafURL();
-        attemptNanoleafConnection();
+        Serial.println("Connection failed. Restarting ESP");
+        ESP.restart();
+        return;
     }
+    Serial.println("Failed to connect to Nanoleaf with saved baseURL, reattempting MDNS lookup.");
+    nanoleafConnectionFailed = true;
+    nanoleafConnectionFailedAt = millis();
+    scheduler.start(nanoleafDiscoveryTask);
+}
+
+void attemptNanoleafConnection()
+{
+    bootTimeline.start(BootTimeline::NANOLEAF);
+    nanoleaf.setup(nanoleafBaseUrl, nanoleafAuthToken);
+    nanoleaf.restoreLayout(LAYOUT_FILE);
+    scheduler.start(nanoleafConnectTask);
 }
 
 void setupMQTTClient()
 {
     mqttClient.setup(DEFAULT_MQTT_BROKER, DEFAULT_MQTT_PORT, friendId);
     mqttClient.addTopicAdapter(&colorPaletteAdapter);
+    mqttClient.addTopicAdapter(&packedPaletteAdapter);
+
+    // Only palettes that reached the panels are cached, coalesced ones were never shown
+    colorPipeline.setWrittenCallback([](const ColorFrame &frame)
+                                     { paletteCache.put(frame); });
+    paletteReplayAdapter.setMissCallback(onPaletteMiss);
+    mqttClient.addTopicAdapter(&paletteReplayAdapter);
+
+    // A reconnect may follow a network or backend outage, the backend gets the full status again
+    mqttClient.setConnectCallback([]()
+                                  { statusRefreshPending = true; });
+}
+
+// Tells the sender to transmit the palette in full, it is cached from then on
+void onPaletteMiss(const JsonObject &request)
+{
+    Serial.println("Replayed palette is not cached");
+    JsonDocument jsonPayload;
+    jsonPayload.set(request);
+    String topic = String("GeoGlow/") + friendId + "/color/miss";
+    mqttClient.publish(topic.c_str(), jsonPayload);
+}
+
+void savePaletteCache()
+{
+    if (paletteCache.save(PALETTE_CACHE_FILE))
+    {
+        Serial.printf("Saved %u cached palettes\n", (unsigned)paletteCache.size());
+    }
 }
 
 void publishHeartbeat()
 {
-    if (!nanoleaf.isConnected())
+    if (scheduler.isActive(nanoleafConnectTask))
+    {
+        Serial.println("Nanoleaf reconnect in progress, skipping heartbeat.");
+        return;
+    }
+    if (!nanoleafs.isConnected())
     {
         Serial.println("Lost connection to nanoleafs. Trying to reconnect.");
+        nanoleafConnectionLost = true;
         attemptNanoleafConnection();
+        return;
+    }
+
+    // Presence itself is the retained online message and the Last Will of the MQTT session
+    if (MQTT_HEARTBEAT && mqttClient.connected())
+    {
+        JsonDocument jsonPayload;
+        jsonPayload["online"] = true;
+        jsonPayload["uptime"] = millis() / 1000;
+        mqttClient.publish(mqttClient.getPresenceTopic().c_str(), jsonPayload);
+        Serial.println("Heartbeat published");
+    }
+
+    HttpConnection::Stats stats = nanoleaf.getConnectionStats();
+    Serial.printf("Nanoleaf connections: %u requests, %u reused, %u handshakes, %u failures\n",
+                  stats.requests, stats.reused, stats.handshakes, stats.failures);
 
-        if (nanoleaf.isConnected())
+    MQTTClient::Stats mqttStats = mqttClient.getStats();
+    Serial.printf("MQTT: %u reconnects, %u failed attempts, %u ms disconnected\n",
+                  mqttStats.reconnects, mqttStats.failedAttempts, mqttStats.disconnectedMs);
+
+    const ColorPipeline::Stats colorStats = colorPipeline.getStats();
+    Serial.printf("Colors: %u received, %u coalesced, %u written, %u failed\n",
+                  colorStats.received, colorStats.coalesced, colorStats.written, colorStats.failed);
+
+    const PaletteCache::Stats cacheStats = paletteCache.getStats();
+    Serial.printf("Palette cache: %u entries, %u hits, %u misses, %u evicted\n", (unsigned)paletteCache.size(),
+                  cacheStats.hits, cacheStats.misses, cacheStats.evicted);
+
+    const WritePacer::Stats &pacerStats = nanoleaf.getPacerStats();
+    Serial.printf("Nanoleaf writes: %u, %u failed, %u backoffs, interval %lu ms, rtt %lu ms (min %lu ms)\n",
+                  pacerStats.writes, pacerStats.failures, pacerStats.backoffs, pacerStats.interval,
+                  pacerStats.smoothedRtt, pacerStats.minRtt);
+
+    scheduler.printStats(Serial);
+    Serial.printf("Free heap: %u bytes\n", (unsigned)ESP.getFreeHeap());
+}
+
+// FNV-1a over the tile ids in layout order, the backend keeps it to validate deltas against
+uint32_t hashLayout(const std::vector<String> &tileIds)
+{
+    uint32_t hash = 2166136261u;
+    for (const String &tileId : tileIds)
+    {
+        // The terminator separates the ids, so "1","23" and "12","3" differ
+        for (size_t i = 0; i <= tileId.length(); i++)
         {
-            Serial.println("Reconnecting worked! Continuing as before.");
+            hash = (hash ^ (uint8_t)tileId.c_str()[i]) * 16777619u;
         }
-        else
+    }
+    return hash;
+}
+
+static bool containsTileId(const std::vector<String> &tileIds, const String &tileId)
+{
+    for (const String &candidate : tileIds)
+    {
+        if (candidate == tileId)
         {
-            Serial.println("Connection failed. Restarting ESP");
-            ESP.restart();
+            return true;
         }
     }
+    return false;
+}
 
-    String url = String(API_URL_PREFIX) + friendId + "/heartbeat";
-    httpClient.begin(wifiClientForHTTP, url);
+// Streams the payload over the keep-alive connection to the backend. Returns the status code or -1
+int sendStatusPatch(const JsonDocument &jsonPayload, JsonDocument &response)
+{
+    HttpConnection *connection = backendConnections.acquire(API_BASE_URL);
+    if (connection == nullptr)
+    {
+        return -1;
+    }
 
-    int httpResponseCode = httpClient.POST("{}");
-    String responseMsg = httpClient.errorToString(httpResponseCode).c_str();
-    switch (httpResponseCode)
+    const String path = String(API_FRIENDS_PATH) + friendId;
+    const size_t length = measureJson(jsonPayload);
+    int httpResponseCode = -1;
+    // A kept-alive connection may have been closed by the server in the meantime, retry once on a fresh one
+    for (int attempt = 0; attempt < 2 && httpResponseCode < 0; attempt++)
     {
-    case 204:
-        Serial.println("Heartbeat posted");
-        break;
-    case 404:
-        publishStatus();
-        break;
-    case 500:
-        Serial.printf("Failed posting heartbeat: %s\n", responseMsg.c_str());
-        break;
-    default:
-        Serial.printf("Unknown error occured: %s\n", responseMsg.c_str());
-        break;
+        if (connection->beginRequest("PATCH", path, length))
+        {
+            BufferedClientWriter writer(connection->requestBody());
+            serializeJson(jsonPayload, writer);
+            if (writer.finish())
+            {
+                httpResponseCode = connection->endRequest();
+            }
+        }
+        if (httpResponseCode < 0)
+        {
+            const bool reused = connection->wasReused();
+            connection->stop();
+            if (!reused)
+            {
+                break;
+            }
+        }
+    }
+    if (httpResponseCode > 0)
+    {
+        JsonDocument filter;
+        filter["layoutHash"] = true;
+        deserializeJson(response, connection->responseBody(), DeserializationOption::Filter(filter));
+        connection->endResponse();
     }
-    httpClient.end();
+    backendConnections.release(connection);
+    return httpResponseCode;
 }
 
 void publishStatus()
 {
+    const std::vector<String> tileIds = nanoleafs.getPanelIds();
+    const uint32_t layoutHash = hashLayout(tileIds);
+    if (statusPublished && layoutHash == publishedLayoutHash)
+    {
+        Serial.println("Layout unchanged, status not published");
+        return;
+    }
+
+    char hash[9];
+    snprintf(hash, sizeof(hash), "%08x", (unsigned)layoutHash);
+
     JsonDocument jsonPayload;
     jsonPayload["friendId"] = friendId;
     jsonPayload["name"] = name;
     jsonPayload["groupId"] = groupId;
-    JsonArray tileIds = jsonPayload["tileIds"].to<JsonArray>();
+    jsonPayload["layoutHash"] = hash;
 
-    for (const String &panelId : nanoleaf.getPanelIds())
+    JsonDocument response;
+    int httpResponseCode = -1;
+    if (statusPublished && backendSupportsDeltas)
     {
-        tileIds.add(panelId);
-    }
-
-    char buffer[512];
-    size_t n = serializeJson(jsonPayload, buffer);
+        // Only the difference to the last accepted layout, the backend rejects it if its hash differs
+        char baseHash[9];
+        snprintf(baseHash, sizeof(baseHash), "%08x", (unsigned)publishedLayoutHash);
+        jsonPayload["baseLayoutHash"] = baseHash;
+        JsonArray addedTileIds = jsonPayload["addedTileIds"].to<JsonArray>();
+        JsonArray removedTileIds = jsonPayload["removedTileIds"].to<JsonArray>();
+        for (const String &tileId : tileIds)
+        {
+            if (!containsTileId(publishedTileIds, tileId))
+            {
+                addedTileIds.add(tileId);
+            }
+        }
+        for (const String &tileId : publishedTileIds)
+        {
+            if (!containsTileId(tileIds, tileId))
+            {
+                removedTileIds.add(tileId);
+            }
+        }
 
-    String url = String(API_URL_PREFIX) + friendId;
-    httpClient.begin(wifiClientForHTTP, url);
-    httpClient.addHeader("Content-Type", "application/json");
+        httpResponseCode = sendStatusPatch(jsonPayload, response);
+        if (httpResponseCode >= 400 && httpResponseCode < 500)
+        {
+            Serial.printf("Delta rejected (%d), sending the full layout\n", httpResponseCode);
+            jsonPayload.remove("baseLayoutHash");
+            jsonPayload.remove("addedTileIds");
+            jsonPayload.remove("removedTileIds");
+            httpResponseCode = -1;
+        }
+    }
 
-    int httpResponseCode = httpClient.sendRequest("PATCH", (uint8_t *)buffer, n);
+    if (httpResponseCode == -1 && !jsonPayload["baseLayoutHash"].is<const char *>())
+    {
+        JsonArray fullTileIds = jsonPayload["tileIds"].to<JsonArray>();
+        for (const String &tileId : tileIds)
+        {
+            fullTileIds.add(tileId);
+        }
+        httpResponseCode = sendStatusPatch(jsonPayload, response);
+    }
 
-    if (httpResponseCode == 201 || httpResponseCode == 204)
+    if (httpResponseCode >= 200 && httpResponseCode < 300)
     {
         Serial.printf("PATCH successfull, response code: %d\n", httpResponseCode);
+        publishedTileIds = tileIds;
+        publishedLayoutHash = layoutHash;
+        statusPublished = true;
+        // A backend that ignores the delta fields would accept them and silently keep old tiles
+        backendSupportsDeltas = strcmp(response["layoutHash"] | "", hash) == 0;
+        return;
+    }
+
+    // Whatever the backend holds now is unknown, the next status is sent in full
+    statusPublished = false;
+    if (httpResponseCode < 0)
+    {
+        Serial.println("Error occured while making PATCH request: connection failed");
     }
     else
     {
-        Serial.printf("Error occured while making PATCH request: %s\n", httpClient.errorToString(httpResponseCode).c_str());
+        Serial.printf("Error occured while making PATCH request, response code: %d\n", httpResponseCode);
     }
+}
 
-    httpClient.end();
+// Sends the full status even if the layout did not change, in case the backend lost it
+void refreshStatus()
+{
+    statusPublished = false;
+    if (initialStatusPublished)
+    {
+        publishStatus();
+    }
 }
 
 bool ensureNanoleafURL()
@@ -383,36 +890,166 @@ bool ensureNanoleafURL()
         return true;
 }
 
-void registerNanoleafEvents()
+bool tryRegisterNanoleafEvents()
 {
     std::vector<int> eventIds = {2};
-    bool success = false;
-    const int maxRetries = 5;
+    bool registered = true;
+    for (size_t i = 0; i < nanoleafs.size(); i++)
+    {
+        // Streams that are still open are kept
+        NanoleafApiWrapper &device = nanoleafs.get(i);
+        if (!device.isListeningForEvents() && !device.registerEvents(eventIds))
+        {
+            Serial.printf("Event registration for %s failed\n", device.getBaseUrl().c_str());
+            registered = false;
+        }
+    }
 
-    for (int attempt = 1; attempt <= maxRetries; attempt++)
+    if (!registered)
     {
-        success = nanoleaf.registerEvents(eventIds);
-        if (success)
+        const unsigned int attempts = scheduler.getAttempts(eventRegistrationTask);
+        Serial.printf("Event registration failed, attempt %u\n", attempts);
+        if (attempts == EVENT_POLLING_FALLBACK_ATTEMPTS && publishLayoutMode == ONEVENTS)
+        {
+            // Keep retrying in the background, publish the layout on every heartbeat meanwhile
+            Serial.println("Setting publishLayoutMode to ONHEARTBEAT until events are registered.");
+            publishLayoutMode = ONHEARTBEAT;
+        }
+        return false;
+    }
+
+    Serial.println("Nanoleaf events registered.");
+
+    if (publishLayoutMode == ONHEARTBEAT)
+    {
+        Serial.println("Setting publishLayoutMode back to ONEVENTS.");
+        publishLayoutMode = ONEVENTS;
+    }
+    if (eventStreamInterrupted)
+    {
+        // Layout changes while the stream was down went unnoticed
+        for (size_t i = 0; i < nanoleafs.size(); i++)
+        {
+            nanoleafs.get(i).invalidateLayout();
+        }
+        layoutChanged = true;
+        eventStreamInterrupted = false;
+    }
+    return true;
+}
+
+void onEventStreamLost()
+{
+    eventStreamInterrupted = true;
+    scheduler.start(eventRegistrationTask, EVENT_REGISTRATION_RETRY.initialDelay);
+}
+
+void setupAdditionalNanoleafs()
+{
+    for (size_t i = 0; i < additionalNanoleafCount; i++)
+    {
+        NanoleafApiWrapper *device = nanoleafs.addDevice();
+        if (device == nullptr)
         {
-            nanoleaf.setLayoutChangeCallback([]()
-                                             { layoutChanged = true; });
             break;
         }
-        else
+        device->setup(additionalNanoleafs[i].baseUrl, additionalNanoleafs[i].authToken);
+        device->restoreLayout(ADDITIONAL_LAYOUT_FILES[i]);
+        device->setColorCallback(colorCallback);
+        device->setEventStreamLostCallback(onEventStreamLost);
+        device->setLayoutChangeCallback([]()
+                                        { layoutChanged = true; });
+        Serial.printf("Additional Nanoleaf %s at %s\n", additionalNanoleafs[i].deviceId, additionalNanoleafs[i].baseUrl);
+    }
+}
+
+bool isAdditionalNanoleaf(const char *deviceId)
+{
+    for (size_t i = 0; i < additionalNanoleafCount; i++)
+    {
+        if (strcmp(additionalNanoleafs[i].deviceId, deviceId) == 0)
         {
-            Serial.printf("Event registration failed, attempt %d/%d\n", attempt, maxRetries);
-            delay(1000);
+            return true;
         }
     }
+    return false;
+}
 
-    if (!success)
+// Further Nanoleafs that answered the discovery are paired as well if their power button is
+// held within ADDITIONAL_PAIRING_WINDOW. Only devices with a device ID can be found again later
+void pairAdditionalNanoleafs()
+{
+    Serial.println("Weitere Nanoleafs koppeln: Power-Taste am jeweiligen Gerät gedrückt halten...");
+    // Tokens are requested through a scratch wrapper, the primary one keeps pointing at its device
+    std::unique_ptr<NanoleafApiWrapper> pairing(new NanoleafApiWrapper(nanoleafConnections));
+    const unsigned long startedAt = millis();
+    while (millis() - startedAt < ADDITIONAL_PAIRING_WINDOW &&
+           additionalNanoleafCount < NanoleafRegistry::MAX_DEVICES - 1)
     {
-        Serial.println("Event registration failed after maximum retries. Setting publishLayoutMode to ONHEARTBEAT.");
-        publishLayoutMode = ONHEARTBEAT;
-        return;
+        bool unpaired = false;
+        for (size_t i = 0; nanoleafDiscovery.getDevice(i) != nullptr; i++)
+        {
+            const NanoleafDiscovery::Device &device = *nanoleafDiscovery.getDevice(i);
+            if (device.id[0] == '\0' || strcmp(device.id, nanoleafDeviceId) == 0 || isAdditionalNanoleaf(device.id))
+            {
+                continue;
+            }
+            unpaired = true;
+
+            AdditionalNanoleaf &additional = additionalNanoleafs[additionalNanoleafCount];
+            NanoleafDiscovery::buildBaseUrl(device, additional.baseUrl, sizeof(additional.baseUrl));
+            pairing->setup(additional.baseUrl, "");
+            String token = pairing->generateToken();
+            if (!token.isEmpty())
+            {
+                token.toCharArray(additional.authToken, sizeof(additional.authToken));
+                strncpy(additional.deviceId, device.id, sizeof(additional.deviceId) - 1);
+                additionalNanoleafCount++;
+                // Driven from now on, e.g. by the setup confirmation
+                NanoleafApiWrapper *paired = nanoleafs.addDevice();
+                if (paired != nullptr)
+                {
+                    paired->setup(additional.baseUrl, additional.authToken);
+                }
+                Serial.printf("Nanoleaf %s gekoppelt.\n", device.id);
+                break;
+            }
+        }
+        if (!unpaired)
+        {
+            break;
+        }
+        blink_led(500);
     }
+}
 
-    Serial.println("Nanoleaf events registered.");
+// The additional Nanoleafs are found again by their device ID whenever a discovery ran
+void updateAdditionalNanoleafAddresses()
+{
+    bool changed = false;
+    for (size_t i = 0; i < additionalNanoleafCount && i + 1 < nanoleafs.size(); i++)
+    {
+        AdditionalNanoleaf &additional = additionalNanoleafs[i];
+        const NanoleafDiscovery::Device *device = nanoleafDiscovery.select(additional.deviceId);
+        if (additional.deviceId[0] == '\0' || device == nullptr)
+        {
+            continue;
+        }
+
+        char url[sizeof(additional.baseUrl)];
+        NanoleafDiscovery::buildBaseUrl(*device, url, sizeof(url));
+        if (strcmp(url, additional.baseUrl) != 0)
+        {
+            Serial.printf("Nanoleaf %s moved to %s\n", additional.deviceId, url);
+            strncpy(additional.baseUrl, url, sizeof(additional.baseUrl) - 1);
+            nanoleafs.get(i + 1).setup(additional.baseUrl, additional.authToken);
+            changed = true;
+        }
+    }
+    if (changed)
+    {
+        saveConfigToFile();
+    }
 }
 
 void publishInitialHeartbeat()
@@ -474,21 +1111,92 @@ void initialSetup()
         blink_led(500);
         generateNanoleafToken();
     }
+    pairAdditionalNanoleafs();
 
     initialSetupDone = true;
     digitalWrite(LED_BUILTIN, HIGH);
     saveConfigToFile();
 
-    const int red[] = {255, 0, 0};
-    nanoleaf.setStaticColor(red);
     Serial.println("Ersteinrichtung abgeschlossen. Der ESP wird neu gestartet...");
-    ESP.restart();
+    scheduler.start(setupConfirmationTask);
+}
+
+// Flashes the panels red three times to confirm the initial setup, then restarts
+void flashSetupConfirmation()
+{
+    static int step = 0;
+    const int red[] = {255, 0, 0};
+
+    if (step >= 6)
+    {
+        ESP.restart();
+    }
+    else
+    {
+        for (size_t i = 0; i < nanoleafs.size(); i++)
+        {
+            if (step % 2 == 0)
+            {
+                nanoleafs.get(i).setStaticColor(red);
+            }
+            else
+            {
+                nanoleafs.get(i).setPower(false);
+            }
+        }
+    }
+    step++;
+}
+
+void powerOffAfterIdle()
+{
+    if (currentlyShowingCustomColor)
+    {
+        for (size_t i = 0; i < nanoleafs.size(); i++)
+        {
+            nanoleafs.get(i).setPower(false);
+        }
+        currentlyShowingCustomColor = false;
+    }
+}
+
+void publishHeartbeatOrStatus()
+{
+    // If publish mode is on heartbeat, publish layout every heartbeat
+    if (publishLayoutMode == ONHEARTBEAT)
+    {
+        // Without events nothing invalidates the cached layouts, so they are queried again
+        for (size_t i = 0; i < nanoleafs.size(); i++)
+        {
+            nanoleafs.get(i).invalidateLayout();
+        }
+        publishStatus();
+    }
+    else // just publish the heartbeat itself
+    {
+        publishHeartbeat();
+    }
 }
 
 void colorCallback()
 {
-    lastColorTime = millis();
-    currentlyShowingCustomColor = true;
+    colorWritten = true;
+}
+
+void setupTasks()
+{
+    heartbeatTask = scheduler.addPeriodic("heartbeat", PUBLISH_INTERVAL, publishHeartbeatOrStatus);
+    idlePowerOffTask = scheduler.addOneShot("idle-power-off", powerOffAfterIdle);
+    nanoleafConnectTask = scheduler.addRetry("nanoleaf-connect", NANOLEAF_CONNECT_RETRY, tryNanoleafConnection,
+                                             onNanoleafConnectionFailed);
+    nanoleafDiscoveryTask = scheduler.addRetry("nanoleaf-discovery", NANOLEAF_DISCOVERY_RETRY, tryNanoleafDiscovery);
+    eventRegistrationTask = scheduler.addRetry("event-registration", EVENT_REGISTRATION_RETRY,
+                                               tryRegisterNanoleafEvents);
+    setupConfirmationTask = scheduler.addPeriodic("setup-confirmation", 1000, flashSetupConfirmation);
+    paletteCacheSaveTask = scheduler.addOneShot("palette-cache-save", savePaletteCache);
+    wifiDhcpHandoverTask = scheduler.addOneShot("wifi-dhcp-handover", handOverWifiToDhcp);
+    statusRefreshTask = scheduler.addPeriodic("status-refresh", STATUS_REFRESH_INTERVAL, refreshStatus);
+    wifiLeaseRefreshTask = scheduler.addOneShot("wifi-lease-refresh", finishDhcpHandover);
 }
 
 void setup()
@@ -502,33 +1210,102 @@ void setup()
     pinMode(RESET_BTN_PIN, INPUT_PULLUP);
     attachInterrupt(digitalPinToInterrupt(RESET_BTN_PIN), handleResetInterrupt, CHANGE);
 
+    setupTasks();
+    bootTimeline.start(BootTimeline::CONFIG);
+    FileSystemHandler::mount();
     loadConfigFromFile();
+    bootTimeline.finish(BootTimeline::CONFIG);
 
     if (!initialSetupDone)
     {
         initialSetup();
+        return;
     }
 
-    // loadConfigFromFile();
+    bootTimeline.start(BootTimeline::WIFI);
     connectToWifi(true);
-    ensureNanoleafURL();
+    bootTimeline.finish(BootTimeline::WIFI);
+
+    // From here on MQTT connects from loop() while the Nanoleaf is discovered and connected
+    // by scheduler tasks, none of them waits for the other
+    bootTimeline.start(BootTimeline::MQTT);
     setupMQTTClient();
-    attemptNanoleafConnection();
     nanoleaf.setColorCallback(colorCallback);
-    publishStatus();
-    publishInitialHeartbeat();
+    nanoleaf.setEventStreamLostCallback(onEventStreamLost);
+    nanoleafDiscovery.setQueryFinishedCallback(onNanoleafQueryFinished);
+    nanoleaf.setLayoutChangeCallback([]()
+                                     { layoutChanged = true; });
+    setupAdditionalNanoleafs();
+    if (PALETTE_CACHE_PERSIST)
+    {
+        paletteCache.restore(PALETTE_CACHE_FILE);
+    }
+    colorPipeline.begin();
+
+    if (strlen(nanoleafBaseUrl) > 0)
+    {
+        attemptNanoleafConnection();
+    }
+    else
+    {
+        bootTimeline.start(BootTimeline::DISCOVERY);
+        scheduler.start(nanoleafDiscoveryTask);
+    }
+    scheduler.start(heartbeatTask, PUBLISH_INTERVAL);
+    scheduler.start(statusRefreshTask, STATUS_REFRESH_INTERVAL);
+}
+
+void updateBootTimeline()
+{
+    if (bootTimingsPublished)
+    {
+        return;
+    }
+
+    if (mqttClient.connected())
+    {
+        bootTimeline.finish(BootTimeline::MQTT);
+    }
+    // Palettes are written with the cached URL and token before the connection is confirmed
+    if (bootTimeline.isFinished(BootTimeline::MQTT) && bootTimeline.isStarted(BootTimeline::NANOLEAF))
+    {
+        bootTimeline.finish(BootTimeline::COLOR_READY);
+    }
+
+    if (bootTimeline.isFinished(BootTimeline::COLOR_READY) && bootTimeline.isFinished(BootTimeline::STATUS))
+    {
+        Serial.println("Boot timeline:");
+        bootTimeline.printTo(Serial);
+
+        JsonDocument jsonPayload;
+        jsonPayload["firmware"] = FIRMWARE_VERSION;
+        bootTimeline.toJson(jsonPayload["phases"].to<JsonObject>());
+        String topic = String("GeoGlow/") + friendId + "/boot";
+        mqttClient.publish(topic.c_str(), jsonPayload);
+        bootTimingsPublished = true;
+    }
 }
 
 void loop()
 {
+    scheduler.run();
+
+    // Only the confirmation of the initial setup is running until the restart
+    if (scheduler.isActive(setupConfirmationTask))
+    {
+        return;
+    }
+
     mqttClient.loop();
-    nanoleaf.processEvents();
-    unsigned long now = millis();
+    nanoleafDiscovery.loop();
+    colorPipeline.pump();
+    nanoleafs.processEvents();
+    updateBootTimeline();
 
-    if (now - lastColorTime >= 360000 && currentlyShowingCustomColor)
+    if (colorWritten.exchange(false))
     {
-        nanoleaf.setPower(false);
-        currentlyShowingCustomColor = false;
+        currentlyShowingCustomColor = true;
+        scheduler.start(idlePowerOffTask, IDLE_POWER_OFF_DELAY);
     }
 
     if (layoutChanged)
@@ -537,18 +1314,15 @@ void loop()
         layoutChanged = false;
     }
 
-    if (now - lastPublishTime >= PUBLISH_INTERVAL)
+    if (statusRefreshPending)
     {
-        // If publish mode is on heartbeat, publish layout every heartbeat
-        if (publishLayoutMode == ONHEARTBEAT)
-        {
-            publishStatus();
-        }
-        else // just publish the heartbeat itself
-        {
-            publishHeartbeat();
-        }
+        statusRefreshPending = false;
+        refreshStatus();
+    }
 
-        lastPublishTime = now;
+    // Batches new palettes into one flash write
+    if (PALETTE_CACHE_PERSIST && paletteCache.isDirty() && !scheduler.isActive(paletteCacheSaveTask))
+    {
+        scheduler.start(paletteCacheSaveTask, PALETTE_CACHE_SAVE_DELAY);
     }
 }
@@ -0,0 +1,142 @@
+#include "CooperativeScheduler.h"
+
+CooperativeScheduler::TaskId CooperativeScheduler::add(const char *name, const TaskType type)
+{
+    Task task = {};
+    task.type = type;
+    task.active = false;
+    task.stats.name = name;
+    tasks.push_back(task);
+    return tasks.size() - 1;
+}
+
+CooperativeScheduler::TaskId CooperativeScheduler::addOneShot(const char *name, TaskCallback callback)
+{
+    TaskId id = add(name, ONE_SHOT);
+    tasks[id].callback = callback;
+    return id;
+}
+
+CooperativeScheduler::TaskId CooperativeScheduler::addPeriodic(const char *name, const unsigned long interval,
+                                                               TaskCallback callback)
+{
+    TaskId id = add(name, PERIODIC);
+    tasks[id].interval = interval;
+    tasks[id].callback = callback;
+    return id;
+}
+
+CooperativeScheduler::TaskId CooperativeScheduler::addRetry(const char *name, const RetryPolicy &policy,
+                                                            RetryCallback callback, TaskCallback onGiveUp)
+{
+    TaskId id = add(name, RETRY);
+    tasks[id].policy = policy;
+    tasks[id].retryCallback = callback;
+    tasks[id].onGiveUp = onGiveUp;
+    return id;
+}
+
+void CooperativeScheduler::start(const TaskId id, const unsigned long delay)
+{
+    Task &task = tasks[id];
+    task.active = true;
+    task.dueAt = millis() + delay;
+    task.attempts = 0;
+    task.retryDelay = task.policy.initialDelay;
+}
+
+void CooperativeScheduler::stop(const TaskId id)
+{
+    tasks[id].active = false;
+}
+
+bool CooperativeScheduler::isActive(const TaskId id) const
+{
+    return tasks[id].active;
+}
+
+unsigned int CooperativeScheduler::getAttempts(const TaskId id) const
+{
+    return tasks[id].attempts;
+}
+
+void CooperativeScheduler::execute(Task &task, const unsigned long now)
+{
+    switch (task.type)
+    {
+    case ONE_SHOT:
+        task.active = false;
+        task.callback();
+        break;
+
+    case PERIODIC:
+        // Keep the period stable, but do not try to catch up on missed runs
+        task.dueAt += task.interval;
+        if (static_cast<long>(now - task.dueAt) >= 0)
+        {
+            task.dueAt = now + task.interval;
+        }
+        task.callback();
+        break;
+
+    case RETRY:
+        task.attempts++;
+        if (task.retryCallback())
+        {
+            task.active = false;
+        }
+        else if (task.policy.maxAttempts > 0 && task.attempts >= task.policy.maxAttempts)
+        {
+            task.active = false;
+            if (task.onGiveUp)
+            {
+                task.onGiveUp();
+            }
+        }
+        else if (task.active)
+        {
+            task.dueAt = millis() + task.retryDelay;
+            task.retryDelay = min(static_cast<unsigned long>(task.retryDelay * task.policy.backoffFactor),
+                                  task.policy.maxDelay);
+        }
+        break;
+    }
+}
+
+void CooperativeScheduler::run()
+{
+    for (Task &task : tasks)
+    {
+        const unsigned long now = millis();
+        if (!task.active || static_cast<long>(now - task.dueAt) < 0)
+        {
+            continue;
+        }
+
+        const unsigned long startedAt = micros();
+        execute(task, now);
+        const uint32_t duration = micros() - startedAt;
+
+        task.stats.runs++;
+        task.stats.totalMicros += duration;
+        if (duration > task.stats.maxMicros)
+        {
+            task.stats.maxMicros = duration;
+        }
+    }
+}
+
+const CooperativeScheduler::TaskStats &CooperativeScheduler::getStats(const TaskId id) const
+{
+    return tasks[id].stats;
+}
+
+void CooperativeScheduler::printStats(Print &out) const
+{
+    for (const Task &task : tasks)
+    {
+        const TaskStats &stats = task.stats;
+        out.printf("Task %-18s runs: %6u avg: %8u us max: %8u us\n", stats.name, stats.runs,
+                   stats.runs > 0 ? static_cast<uint32_t>(stats.totalMicros / stats.runs) : 0, stats.maxMicros);
+    }
+}
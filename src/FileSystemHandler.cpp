@@ -1,18 +1,192 @@
 #include "FileSystemHandler.h"
 
+namespace
+{
+    const size_t HEADER_LENGTH = 10; // "#" + 8 hex digits + "\n"
+
+    bool mounted = false;
+
+    struct TrackedFile
+    {
+        char path[FileSystemHandler::MAX_PATH_LENGTH + 1];
+        uint32_t crc;
+    };
+    TrackedFile trackedFiles[FileSystemHandler::MAX_TRACKED_FILES];
+
+    // CRC-32 (IEEE 802.3) with a 16 entry table, processed one nibble at a time
+    uint32_t updateCrc(uint32_t crc, const uint8_t *data, size_t length)
+    {
+        static const uint32_t table[16] = {
+            0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+            0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C};
+
+        crc = ~crc;
+        for (size_t i = 0; i < length; i++)
+        {
+            crc = table[(crc ^ data[i]) & 0x0F] ^ (crc >> 4);
+            crc = table[(crc ^ (data[i] >> 4)) & 0x0F] ^ (crc >> 4);
+        }
+        return ~crc;
+    }
+
+    // Checksums the serialized JSON without buffering it
+    class CrcPrint : public Print
+    {
+    public:
+        using Print::write;
+
+        size_t write(uint8_t c) override
+        {
+            crc = updateCrc(crc, &c, 1);
+            return 1;
+        }
+
+        size_t write(const uint8_t *buffer, size_t size) override
+        {
+            crc = updateCrc(crc, buffer, size);
+            return size;
+        }
+
+        uint32_t crc = 0;
+    };
+
+    // Checksums everything the JSON parser reads from the file
+    class CrcReader : public Stream
+    {
+    public:
+        explicit CrcReader(Stream &source) : source(source) {}
+
+        int available() override
+        {
+            return source.available();
+        }
+
+        int read() override
+        {
+            const int c = source.read();
+            if (c >= 0)
+            {
+                const uint8_t byte = c;
+                crc = updateCrc(crc, &byte, 1);
+            }
+            return c;
+        }
+
+        int peek() override
+        {
+            return source.peek();
+        }
+
+        size_t readBytes(char *buffer, size_t length) override
+        {
+            const size_t read = source.readBytes(buffer, length);
+            crc = updateCrc(crc, (const uint8_t *)buffer, read);
+            return read;
+        }
+
+        size_t write(uint8_t) override
+        {
+            return 0;
+        }
+
+        // Includes whatever follows the JSON document
+        void drain()
+        {
+            char buffer[32];
+            while (readBytes(buffer, sizeof(buffer)) > 0)
+            {
+            }
+        }
+
+        uint32_t crc = 0;
+
+    private:
+        Stream &source;
+    };
+}
+
+bool FileSystemHandler::mount()
+{
+    if (!mounted)
+    {
+        mounted = FILESYSTEM.begin();
+        if (!mounted)
+        {
+            Serial.println("Failed to mount FS");
+        }
+    }
+    return mounted;
+}
+
+bool FileSystemHandler::findChecksum(const char *path, uint32_t &crc)
+{
+    for (const TrackedFile &file : trackedFiles)
+    {
+        if (strcmp(file.path, path) == 0)
+        {
+            crc = file.crc;
+            return true;
+        }
+    }
+    return false;
+}
+
+void FileSystemHandler::rememberChecksum(const char *path, const uint32_t crc)
+{
+    if (strlen(path) > MAX_PATH_LENGTH)
+    {
+        return;
+    }
+    TrackedFile *freeEntry = nullptr;
+    for (TrackedFile &file : trackedFiles)
+    {
+        if (strcmp(file.path, path) == 0)
+        {
+            file.crc = crc;
+            return;
+        }
+        if (freeEntry == nullptr && file.path[0] == '\0')
+        {
+            freeEntry = &file;
+        }
+    }
+    if (freeEntry != nullptr)
+    {
+        strcpy(freeEntry->path, path);
+        freeEntry->crc = crc;
+    }
+}
+
+void FileSystemHandler::forgetChecksum(const char *path)
+{
+    for (TrackedFile &file : trackedFiles)
+    {
+        if (strcmp(file.path, path) == 0)
+        {
+            file.path[0] = '\0';
+        }
+    }
+}
+
 bool FileSystemHandler::removeConfigFile(const char *path)
 {
-    if (!FILESYSTEM.begin())
+    if (!mount())
     {
-        Serial.println("Failed to mount FS for delete");
         return false;
     }
+    forgetChecksum(path);
+
+    const String tempPath = String(path) + ".tmp";
+    if (FILESYSTEM.exists(tempPath))
+    {
+        FILESYSTEM.remove(tempPath);
+    }
+
     if (FILESYSTEM.exists(path))
     {
         if (!FILESYSTEM.remove(path))
         {
             Serial.println("Failed to delete config file");
-            FILESYSTEM.end();
             return false;
         }
         Serial.println("Config file deleted");
@@ -21,23 +195,19 @@ bool FileSystemHandler::removeConfigFile(const char *path)
     {
         Serial.println("Config file does not exist");
     }
-
-    FILESYSTEM.end();
     return true;
 }
 
 bool FileSystemHandler::loadConfigFromFile(const char *path, JsonDocument &jsonDoc, size_t jsonSize)
 {
-    if (!FILESYSTEM.begin())
+    if (!mount())
     {
-        Serial.println("Failed to mount FS");
         return false;
     }
 
     if (!FILESYSTEM.exists(path))
     {
         Serial.println("Config file does not exist");
-        FILESYSTEM.end();
         return false;
     }
 
@@ -45,61 +215,93 @@ bool FileSystemHandler::loadConfigFromFile(const char *path, JsonDocument &jsonD
     if (!configFile)
     {
         Serial.println("Failed to open config file");
-        FILESYSTEM.end();
         return false;
     }
 
-    size_t size = configFile.size();
-    if (size > jsonSize)
+    if (configFile.size() > jsonSize + HEADER_LENGTH)
     {
         Serial.println("Config file is too large");
         configFile.close();
-        FILESYSTEM.end();
         return false;
     }
 
-    std::unique_ptr<char[]> buf(new char[size]);
-    configFile.readBytes(buf.get(), size);
+    const bool hasChecksum = configFile.peek() == '#';
+    uint32_t expectedCrc = 0;
+    if (hasChecksum)
+    {
+        char header[HEADER_LENGTH + 1] = "";
+        configFile.readBytes(header, HEADER_LENGTH);
+        expectedCrc = strtoul(header + 1, nullptr, 16);
+    }
+
+    // Parsed straight from the file, the content is never buffered as a whole
+    CrcReader reader(configFile);
+    DeserializationError error = deserializeJson(jsonDoc, reader);
+    reader.drain();
     configFile.close();
-    FILESYSTEM.end();
 
-    DeserializationError error = deserializeJson(jsonDoc, buf.get());
+    if (hasChecksum && reader.crc != expectedCrc)
+    {
+        Serial.println("Config file is corrupt (checksum mismatch)");
+        return false;
+    }
     if (error)
     {
         Serial.println("Failed to parse JSON config file");
         return false;
     }
 
+    rememberChecksum(path, reader.crc);
     Serial.println("Parsed JSON config");
     return true;
 }
 
 bool FileSystemHandler::saveConfigToFile(const char *path, const JsonDocument &jsonDoc)
 {
-    if (!FILESYSTEM.begin())
+    CrcPrint checksum;
+    serializeJson(jsonDoc, checksum);
+
+    uint32_t storedCrc;
+    if (findChecksum(path, storedCrc) && storedCrc == checksum.crc)
+    {
+        Serial.println("Config unchanged, not written");
+        return true;
+    }
+
+    if (!mount())
     {
-        Serial.println("Failed to mount FS for save");
         return false;
     }
 
-    File configFile = FILESYSTEM.open(path, "w");
+    const String tempPath = String(path) + ".tmp";
+    File configFile = FILESYSTEM.open(tempPath, "w");
     if (!configFile)
     {
         Serial.println("Failed to open config file for writing");
-        FILESYSTEM.end();
         return false;
     }
 
-    if (serializeJson(jsonDoc, configFile) == 0)
+    char header[HEADER_LENGTH + 1];
+    snprintf(header, sizeof(header), "#%08x\n", (unsigned int)checksum.crc);
+    if (configFile.write((const uint8_t *)header, HEADER_LENGTH) != HEADER_LENGTH ||
+        serializeJson(jsonDoc, configFile) == 0)
     {
         Serial.println("Failed to write JSON to config file");
         configFile.close();
-        FILESYSTEM.end();
+        FILESYSTEM.remove(tempPath);
+        return false;
+    }
+    configFile.close();
+
+    // The old file stays intact until the new one is complete
+    if (!FILESYSTEM.rename(tempPath, path))
+    {
+        Serial.println("Failed to replace config file");
+        FILESYSTEM.remove(tempPath);
         return false;
     }
 
+    rememberChecksum(path, checksum.crc);
     Serial.println("Config saved successfully");
-    configFile.close();
-    FILESYSTEM.end();
     return true;
-}
\ No newline at end of file
+}
@@ -0,0 +1,430 @@
+#include "HttpConnectionManager.h"
+
+void HttpBodyStream::begin(WiFiClient *client, const long contentLength, const bool chunked,
+                           const unsigned long timeout)
+{
+    this->client = client;
+    this->remaining = chunked ? 0 : contentLength;
+    this->chunked = chunked;
+    this->firstChunk = true;
+    this->done = !chunked && contentLength == 0;
+    setTimeout(timeout);
+}
+
+bool HttpBodyStream::nextChunk()
+{
+    char line[16];
+
+    // Every chunk but the first is preceded by the CRLF closing the previous one
+    if (!firstChunk)
+    {
+        client->readBytesUntil('\n', line, sizeof(line));
+    }
+    firstChunk = false;
+
+    size_t n = client->readBytesUntil('\n', line, sizeof(line) - 1);
+    if (n == 0)
+    {
+        done = true;
+        return false;
+    }
+    line[n] = '\0';
+    remaining = strtol(line, nullptr, 16);
+
+    if (remaining <= 0)
+    {
+        // Last chunk, skip the (empty) trailer
+        client->readBytesUntil('\n', line, sizeof(line));
+        done = true;
+        return false;
+    }
+    return true;
+}
+
+bool HttpBodyStream::finished()
+{
+    if (!done && remaining < 0 && !client->connected() && !client->available())
+    {
+        done = true;
+    }
+    return done;
+}
+
+int HttpBodyStream::available()
+{
+    if (finished() || (remaining == 0 && chunked))
+    {
+        return 0;
+    }
+    const int available = client->available();
+    return remaining < 0 ? available : min(static_cast<long>(available), remaining);
+}
+
+int HttpBodyStream::read()
+{
+    if (finished())
+    {
+        return -1;
+    }
+    if (remaining == 0 && (!chunked || !nextChunk()))
+    {
+        done = true;
+        return -1;
+    }
+
+    const int c = client->read();
+    if (c >= 0 && remaining > 0)
+    {
+        remaining--;
+        if (remaining == 0 && !chunked)
+        {
+            done = true;
+        }
+    }
+    return c;
+}
+
+int HttpBodyStream::peek()
+{
+    if (finished() || remaining == 0)
+    {
+        return -1;
+    }
+    return client->peek();
+}
+
+size_t HttpBodyStream::readBytes(char *buffer, const size_t length)
+{
+    // Unlike Stream::readBytes this returns as soon as the body ended instead of waiting for the timeout
+    size_t count = 0;
+    unsigned long lastData = millis();
+    while (count < length && !finished() && millis() - lastData < _timeout)
+    {
+        const int c = read();
+        if (c < 0)
+        {
+            yield();
+            continue;
+        }
+        buffer[count++] = static_cast<char>(c);
+        lastData = millis();
+    }
+    return count;
+}
+
+void HttpBodyStream::drain()
+{
+    char buffer[64];
+    while (!finished() && readBytes(buffer, sizeof(buffer)) > 0)
+    {
+    }
+}
+
+HttpConnection::HttpConnection(const String &host, const uint16_t port, const unsigned long timeout)
+    : host(host), port(port), timeout(timeout)
+{
+}
+
+bool HttpConnection::beginRequest(const char *method, const String &path, const size_t contentLength,
+                                  const char *contentType)
+{
+    stats.requests++;
+
+    reused = client.connected() && keepAlive;
+    if (reused)
+    {
+        stats.reused++;
+    }
+    else
+    {
+        client.stop();
+#if defined(ESP32)
+        // The ESP32 client takes the read timeout in seconds and the connect timeout separately
+        client.setTimeout((timeout + 999) / 1000);
+        if (!client.connect(host.c_str(), port, timeout))
+#else
+        client.setTimeout(timeout);
+        if (!client.connect(host.c_str(), port))
+#endif
+        {
+            Serial.printf("Failed to connect to %s:%u\n", host.c_str(), port);
+            stats.failures++;
+            return false;
+        }
+        client.setNoDelay(true);
+        stats.handshakes++;
+    }
+    keepAlive = true;
+
+    // Headers go out in a single write instead of one segment per line
+    char head[256];
+    int n = snprintf(head, sizeof(head),
+                     "%s %s HTTP/1.1\r\n"
+                     "Host: %s:%u\r\n"
+                     "Connection: keep-alive\r\n"
+                     "Content-Type: %s\r\n"
+                     "Content-Length: %u\r\n"
+                     "\r\n",
+                     method, path.c_str(), host.c_str(), port, contentType, static_cast<unsigned>(contentLength));
+    if (n <= 0 || static_cast<size_t>(n) >= sizeof(head))
+    {
+        Serial.println("HTTP request head too long");
+        stats.failures++;
+        return false;
+    }
+
+    if (client.write(reinterpret_cast<const uint8_t *>(head), n) != static_cast<size_t>(n))
+    {
+        stats.failures++;
+        client.stop();
+        return false;
+    }
+    return true;
+}
+
+WiFiClient &HttpConnection::requestBody()
+{
+    return client;
+}
+
+int HttpConnection::endRequest()
+{
+    char line[128];
+
+    // Status line: HTTP/1.1 <code> <reason>
+    size_t n = client.readBytesUntil('\n', line, sizeof(line) - 1);
+    line[n] = '\0';
+    if (n < 12 || strncmp(line, "HTTP/1.", 7) != 0)
+    {
+        stats.failures++;
+        client.stop();
+        return -1;
+    }
+    const int statusCode = atoi(line + 9);
+    keepAlive = line[7] == '1';
+
+    long contentLength = -1;
+    bool chunked = false;
+    while (true)
+    {
+        n = client.readBytesUntil('\n', line, sizeof(line) - 1);
+        if (n == 0)
+        {
+            // Headers cut off
+            stats.failures++;
+            client.stop();
+            return -1;
+        }
+        line[n] = '\0';
+        if (n == 1 && line[0] == '\r')
+        {
+            break;
+        }
+
+        if (strncasecmp(line, "Content-Length:", 15) == 0)
+        {
+            contentLength = atol(line + 15);
+        }
+        else if (strncasecmp(line, "Transfer-Encoding:", 18) == 0 && strstr(line + 18, "chunked") != nullptr)
+        {
+            chunked = true;
+        }
+        else if (strncasecmp(line, "Connection:", 11) == 0 && strstr(line + 11, "close") != nullptr)
+        {
+            keepAlive = false;
+        }
+    }
+
+    if (statusCode == 204 || statusCode == 304 || (statusCode >= 100 && statusCode < 200))
+    {
+        contentLength = 0;
+        chunked = false;
+    }
+    if (contentLength < 0 && !chunked)
+    {
+        // Body runs until the server closes the connection
+        keepAlive = false;
+    }
+
+    body.begin(&client, contentLength, chunked, timeout);
+    return statusCode;
+}
+
+HttpBodyStream &HttpConnection::responseBody()
+{
+    return body;
+}
+
+void HttpConnection::endResponse()
+{
+    if (keepAlive)
+    {
+        body.drain();
+    }
+    if (!keepAlive || !body.finished())
+    {
+        client.stop();
+    }
+}
+
+void HttpConnection::stop()
+{
+    client.stop();
+}
+
+bool HttpConnection::wasReused() const
+{
+    return reused;
+}
+
+bool HttpConnection::matches(const String &host, const uint16_t port) const
+{
+    return this->port == port && this->host == host;
+}
+
+const HttpConnection::Stats &HttpConnection::getStats() const
+{
+    return stats;
+}
+
+HttpConnectionManager::HttpConnectionManager(const unsigned long timeout)
+    : timeout(timeout)
+{
+#if defined(ESP32)
+    mutex = xSemaphoreCreateMutex();
+#endif
+}
+
+HttpConnectionManager::~HttpConnectionManager()
+{
+#if defined(ESP32)
+    vSemaphoreDelete(mutex);
+#endif
+}
+
+HttpConnection *HttpConnectionManager::acquire(const String &baseUrl)
+{
+    // Base URL has the form http://<host>:<port>
+    int hostStart = baseUrl.indexOf("://");
+    hostStart = hostStart < 0 ? 0 : hostStart + 3;
+    int hostEnd = baseUrl.indexOf(':', hostStart);
+    uint16_t port = 80;
+    if (hostEnd < 0)
+    {
+        hostEnd = baseUrl.length();
+    }
+    else
+    {
+        port = baseUrl.substring(hostEnd + 1).toInt();
+    }
+    const String host = baseUrl.substring(hostStart, hostEnd);
+    if (host.isEmpty())
+    {
+        return nullptr;
+    }
+
+#if defined(ESP32)
+    xSemaphoreTake(mutex, portMAX_DELAY);
+#endif
+    HttpConnection *acquired = nullptr;
+    for (Slot &slot : slots)
+    {
+        if (!slot.checkedOut && slot.connection->matches(host, port))
+        {
+            slot.checkedOut = true;
+            acquired = slot.connection.get();
+            break;
+        }
+    }
+
+    if (acquired == nullptr)
+    {
+        // Makes room by closing the oldest idle connection, checked out ones are still in use
+        auto idle = slots.end();
+        if (slots.size() >= MAX_CONNECTIONS)
+        {
+            for (auto slot = slots.begin(); slot != slots.end() && idle == slots.end(); ++slot)
+            {
+                idle = slot->checkedOut ? slots.end() : slot;
+            }
+            if (idle != slots.end())
+            {
+                idle->connection->stop();
+                slots.erase(idle);
+            }
+        }
+        if (slots.size() < MAX_CONNECTIONS)
+        {
+            slots.push_back({std::unique_ptr<HttpConnection>(new HttpConnection(host, port, timeout)), true});
+            acquired = slots.back().connection.get();
+        }
+        else
+        {
+            Serial.printf("All %u connections are in use, no connection to %s\n", (unsigned)MAX_CONNECTIONS,
+                          host.c_str());
+        }
+    }
+#if defined(ESP32)
+    xSemaphoreGive(mutex);
+#endif
+    return acquired;
+}
+
+void HttpConnectionManager::release(HttpConnection *connection)
+{
+#if defined(ESP32)
+    xSemaphoreTake(mutex, portMAX_DELAY);
+#endif
+    for (Slot &slot : slots)
+    {
+        if (slot.connection.get() == connection)
+        {
+            slot.checkedOut = false;
+        }
+    }
+#if defined(ESP32)
+    xSemaphoreGive(mutex);
+#endif
+}
+
+void HttpConnectionManager::stopIdle()
+{
+#if defined(ESP32)
+    xSemaphoreTake(mutex, portMAX_DELAY);
+#endif
+    for (Slot &slot : slots)
+    {
+        if (!slot.checkedOut)
+        {
+            slot.connection->stop();
+        }
+    }
+#if defined(ESP32)
+    xSemaphoreGive(mutex);
+#endif
+}
+
+HttpConnection::Stats HttpConnectionManager::getStats()
+{
+    HttpConnection::Stats total;
+#if defined(ESP32)
+    xSemaphoreTake(mutex, portMAX_DELAY);
+#endif
+    for (const Slot &slot : slots)
+    {
+        const HttpConnection::Stats &stats = slot.connection->getStats();
+        total.requests += stats.requests;
+        total.reused += stats.reused;
+        total.handshakes += stats.handshakes;
+        total.failures += stats.failures;
+    }
+#if defined(ESP32)
+    xSemaphoreGive(mutex);
+#endif
+    return total;
+}
+
+unsigned long HttpConnectionManager::getTimeout() const
+{
+    return timeout;
+}
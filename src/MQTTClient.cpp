@@ -1,13 +1,19 @@
 #include "MQTTClient.h"
+#include "BufferedClientWriter.h"
 
-std::vector<TopicAdapter *> MQTTClient::topicAdapters;
 MQTTClient *MQTTClient::instance = nullptr;
 
 MQTTClient::MQTTClient(WiFiClient &wifiClient)
-    : client(wifiClient)
+    : network(wifiClient), client(wifiClient)
 {
 }
 
+namespace
+{
+    const char PRESENCE_ONLINE[] = R"({"online":true})";
+    const char PRESENCE_OFFLINE[] = R"({"online":false})";
+}
+
 void MQTTClient::setup(const char *mqttBroker, const int mqttPort, const char *friendId)
 {
     client.setServer(mqttBroker, mqttPort);
@@ -19,50 +25,137 @@ void MQTTClient::setup(const char *mqttBroker, const int mqttPort, const char *f
     client.setCallback(staticCallback);
 
     client.setBufferSize(2048);
+    client.setSocketTimeout(SOCKET_TIMEOUT);
 
     this->friendId = friendId;
+    presenceTopic = "GeoGlow/" + this->friendId + "/status";
+
+    stats.disconnected = true;
+    stats.disconnectedSince = millis();
+    nextAttemptAt = stats.disconnectedSince;
 }
 
 void MQTTClient::loop()
 {
+    const unsigned long now = millis();
     if (!client.connected())
     {
-        reconnect();
+        if (!stats.disconnected)
+        {
+            Serial.println("MQTT connection lost");
+            stats.disconnected = true;
+            stats.disconnectedSince = now;
+            backoff = RECONNECT_MIN_DELAY;
+            nextAttemptAt = now;
+        }
+        if (static_cast<long>(now - nextAttemptAt) >= 0)
+        {
+            reconnect(now);
+        }
+        return;
     }
+
+    // PubSubClient handles one packet per call. Working off everything that is already buffered
+    // lets a burst of palettes coalesce before the output writes the newest one
     client.loop();
+    for (int i = 1; i < MAX_PACKETS_PER_LOOP && network.available() > 0; i++)
+    {
+        client.loop();
+    }
 }
 
-void MQTTClient::reconnect()
+void MQTTClient::reconnect(const unsigned long now)
 {
-    while (!client.connected())
+    Serial.print("Attempting MQTT connection...");
+    String mqttClientId = "GeoGlow-" + this->friendId;
+    // The broker publishes the retained offline message as soon as it loses the session
+    if (client.connect(mqttClientId.c_str(), presenceTopic.c_str(), 1, true, PRESENCE_OFFLINE) &&
+        client.publish(presenceTopic.c_str(), PRESENCE_ONLINE, true) && subscribeAll())
     {
-        Serial.print("Attempting MQTT connection...");
-        String mqttClientId = "GeoGlow-" + this->friendId;
-        if (client.connect(mqttClientId.c_str()))
+        Serial.println("connected: " + mqttClientId);
+        stats.disconnectedMs += millis() - stats.disconnectedSince;
+        stats.disconnected = false;
+        if (connectedBefore)
         {
-            Serial.println("connected: " + mqttClientId);
-            for (const auto adapter : topicAdapters)
-            {
-                client.subscribe(buildTopic(adapter).c_str());
-            }
+            stats.reconnects++;
         }
-        else
+        connectedBefore = true;
+        if (connectCallback)
+        {
+            connectCallback();
+        }
+        return;
+    }
+
+    stats.failedAttempts++;
+    // disconnect() overwrites the state with MQTT_DISCONNECTED
+    const int state = client.state();
+    client.disconnect();
+
+    // Equal jitter keeps a fleet from retrying in lockstep after a broker restart
+    const unsigned long retryDelay = backoff / 2 + random(backoff / 2 + 1);
+    nextAttemptAt = now + retryDelay;
+    backoff = backoff * 2 > RECONNECT_MAX_DELAY ? RECONNECT_MAX_DELAY : backoff * 2;
+
+    Serial.print("failed, rc=");
+    Serial.print(state);
+    Serial.printf(" try again in %lu ms\n", retryDelay);
+}
+
+bool MQTTClient::subscribeAll()
+{
+    // Restored right after the CONNACK, a partially subscribed session is dropped and retried
+    for (size_t i = 0; i < router.size(); i++)
+    {
+        if (!client.subscribe(router.getFilter(i).c_str()))
         {
-            Serial.print("failed, rc=");
-            Serial.print(client.state());
-            Serial.println(" try again in 5 seconds");
-            delay(2000);
+            Serial.printf("Failed to subscribe to %s\n", router.getFilter(i).c_str());
+            return false;
         }
     }
+    return true;
+}
+
+const String &MQTTClient::getPresenceTopic() const
+{
+    return presenceTopic;
+}
+
+bool MQTTClient::connected()
+{
+    return client.connected();
+}
+
+void MQTTClient::disconnect()
+{
+    client.disconnect();
+}
+
+MQTTClient::Stats MQTTClient::getStats() const
+{
+    Stats current = stats;
+    if (current.disconnected)
+    {
+        current.disconnectedMs += millis() - current.disconnectedSince;
+    }
+    return current;
 }
 
 void MQTTClient::publish(const char *topic, const JsonDocument &jsonPayload)
 {
     if (client.connected())
     {
-        char buffer[512];
-        size_t n = serializeJson(jsonPayload, buffer);
-        client.publish(topic, buffer, n);
+        // Streamed into the packet, the length is known up front so no buffer caps the payload
+        const size_t length = measureJson(jsonPayload);
+        if (!client.beginPublish(topic, length, false))
+        {
+            Serial.println("MQTT publish failed.");
+            return;
+        }
+        BufferedClientWriter writer(client);
+        serializeJson(jsonPayload, writer);
+        writer.finish();
+        client.endPublish();
     }
     else
     {
@@ -78,12 +171,22 @@ String MQTTClient::buildTopic(const TopicAdapter *adapter) const
     return topic;
 }
 
+void MQTTClient::setConnectCallback(ConnectCallback callback)
+{
+    connectCallback = callback;
+}
+
 void MQTTClient::addTopicAdapter(TopicAdapter *adapter)
 {
-    topicAdapters.push_back(adapter);
+    // The topic is built and compiled once here instead of for every received message
+    const String topic = buildTopic(adapter);
+    if (!router.add(topic, adapter))
+    {
+        return;
+    }
     if (client.connected())
     {
-        client.subscribe(buildTopic(adapter).c_str());
+        client.subscribe(topic.c_str());
     }
 }
 
@@ -98,52 +201,37 @@ void MQTTClient::staticCallback(char *topic, byte *payload, unsigned int length)
 
 void MQTTClient::callback(char *topic, byte *payload, unsigned int length)
 {
-    char payloadBuffer[length + 1];
-    memcpy(payloadBuffer, payload, length);
-    payloadBuffer[length] = '\0';
-
-    JsonDocument jsonDocument;
-
-    DeserializationError error = deserializeJson(jsonDocument, payloadBuffer);
-    if (error)
+    TopicAdapter *adapter = router.route(topic);
+    if (adapter == nullptr)
     {
-        Serial.print("Failed to parse JSON payload: ");
-        Serial.println(error.c_str());
+        Serial.print("Unhandled message [");
+        Serial.print(topic);
+        Serial.print("] ");
+        Serial.write(payload, length);
+        Serial.println();
         return;
     }
 
-    String receivedTopic = String(topic);
-    for (const auto adapter : topicAdapters)
+    if (length > adapter->getMaxPayloadSize())
     {
-        if (matches(buildTopic(adapter), receivedTopic))
-        {
-            adapter->callback(topic, jsonDocument.as<JsonObject>(), length);
-            return;
-        }
+        Serial.printf("Rejected %u byte payload on [%s]\n", length, topic);
+        return;
     }
 
-    Serial.print("Unhandled message [");
-    Serial.print(topic);
-    Serial.print("] ");
-    Serial.println(payloadBuffer);
-}
-
-bool MQTTClient::matches(const String &subscribedTopic, const String &receivedTopic)
-{
-    if (subscribedTopic.endsWith("#"))
+    if (adapter->handleRaw(topic, payload, length))
     {
-        String baseTopic = subscribedTopic.substring(0, subscribedTopic.length() - 1);
-        return receivedTopic.startsWith(baseTopic);
+        return;
     }
-    else if (subscribedTopic.indexOf('+') >= 0)
+
+    // Parsed directly from the PubSubClient buffer into the adapter's document
+    JsonDocument &jsonDocument = adapter->prepareDocument();
+    DeserializationError error = deserializeJson(jsonDocument, reinterpret_cast<const char *>(payload), length);
+    if (error)
     {
-        int plusPos = subscribedTopic.indexOf('+');
-        String preWildcard = subscribedTopic.substring(0, plusPos);
-        String postWildcard = subscribedTopic.substring(plusPos + 1);
-        if (receivedTopic.startsWith(preWildcard) && receivedTopic.endsWith(postWildcard))
-        {
-            return true;
-        }
+        // NoMemory means the payload exceeds what the adapter's document was sized for
+        Serial.printf("Failed to parse %u byte payload on [%s]: %s\n", length, topic, error.c_str());
+        return;
     }
-    return subscribedTopic == receivedTopic;
-}
\ No newline at end of file
+
+    adapter->callback(topic, jsonDocument.as<JsonObject>(), length);
+}
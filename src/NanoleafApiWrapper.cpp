@@ -1,110 +1,298 @@
 #include "NanoleafApiWrapper.h"
 
-NanoleafApiWrapper::NanoleafApiWrapper(const WiFiClient &wifiClient)
-    : client(wifiClient)
+#include <algorithm>
+
+#if defined(ESP32)
+#include <lwip/sockets.h>
+#endif
+
+NanoleafApiWrapper::Lock::Lock(NanoleafApiWrapper &nanoleaf)
+{
+    acquire(nanoleaf);
+}
+
+void NanoleafApiWrapper::Lock::acquire(NanoleafApiWrapper &nanoleaf)
+{
+    if (this->nanoleaf != nullptr)
+    {
+        return;
+    }
+    this->nanoleaf = &nanoleaf;
+#if defined(ESP32)
+    xSemaphoreTakeRecursive(nanoleaf.mutex, portMAX_DELAY);
+#endif
+}
+
+NanoleafApiWrapper::Lock::~Lock()
+{
+#if defined(ESP32)
+    if (nanoleaf != nullptr)
+    {
+        xSemaphoreGiveRecursive(nanoleaf->mutex);
+    }
+#endif
+}
+
+NanoleafApiWrapper::NanoleafApiWrapper(HttpConnectionManager &connections)
+    : connections(connections)
+{
+#if defined(ESP32)
+    mutex = xSemaphoreCreateRecursiveMutex();
+#endif
+    eventParser.setEventCallback([this](const SseParser::Event &event)
+                                 { handleEvent(event); });
+}
+
+NanoleafApiWrapper::~NanoleafApiWrapper()
 {
+    if (pendingConnection != nullptr)
+    {
+        connections.release(pendingConnection);
+    }
+#if defined(ESP32)
+    vSemaphoreDelete(mutex);
+#endif
 }
 
 void NanoleafApiWrapper::setup(const char *nanoleafBaseUrl, const char *nanoleafAuthToken)
 {
+    // Called again when the device moved, the output task may be sending to the old address
+    Lock lock(*this);
     this->nanoleafBaseUrl = nanoleafBaseUrl;
     this->nanoleafAuthToken = nanoleafAuthToken;
+    externalControlActive = false;
+    healthConfirmed = false;
+}
+
+namespace
+{
+    const JsonDocument &powerStateFilter()
+    {
+        static JsonDocument filter;
+        if (filter.isNull())
+        {
+            filter["value"] = true;
+        }
+        return filter;
+    }
+
+    const JsonDocument &authTokenFilter()
+    {
+        static JsonDocument filter;
+        if (filter.isNull())
+        {
+            filter["auth_token"] = true;
+        }
+        return filter;
+    }
+
+    const JsonDocument &panelLayoutFilter()
+    {
+        static JsonDocument filter;
+        if (filter.isNull())
+        {
+            filter["positionData"][0]["panelId"] = true;
+            filter["positionData"][0]["shapeType"] = true;
+        }
+        return filter;
+    }
 }
 
 bool NanoleafApiWrapper::sendRequest(const String &method, const String &endpoint, const JsonDocument *requestBody,
-                                     JsonDocument *responseBody, const bool useAuthToken)
+                                     JsonDocument *responseBody, const bool useAuthToken,
+                                     const JsonDocument *responseFilter)
+{
+    if (requestBody == nullptr)
+    {
+        return sendRequest(method, endpoint, 0, [](WiFiClient &)
+                           { return true; }, responseBody, useAuthToken, responseFilter);
+    }
+
+    // Serialized straight into the socket, the payload is never held as a whole in RAM
+    return sendRequest(method, endpoint, measureJson(*requestBody), [requestBody](WiFiClient &client)
+                       {
+                           BufferedClientWriter writer(client);
+                           serializeJson(*requestBody, writer);
+                           return writer.finish(); },
+                       responseBody, useAuthToken, responseFilter);
+}
+
+bool NanoleafApiWrapper::sendRequest(const String &method, const String &endpoint, const char *requestBody,
+                                     const size_t requestBodyLength, JsonDocument *responseBody,
+                                     const bool useAuthToken)
+{
+    return sendRequest(method, endpoint, requestBodyLength, [requestBody, requestBodyLength](WiFiClient &client)
+                       { return requestBodyLength == 0 ||
+                                client.write(reinterpret_cast<const uint8_t *>(requestBody), requestBodyLength) ==
+                                    requestBodyLength; },
+                       responseBody, useAuthToken);
+}
+
+bool NanoleafApiWrapper::sendRequest(const String &method, const String &endpoint, const size_t requestBodyLength,
+                                     const BodyWriter &writeBody, JsonDocument *responseBody,
+                                     const bool useAuthToken, const JsonDocument *responseFilter)
 {
     if (WiFi.status() != WL_CONNECTED)
     {
         Serial.println("WiFi Disconnected");
         return false;
     }
-    HTTPClient http;
-    String url = nanoleafBaseUrl;
 
-    if (useAuthToken)
-    {
-        url += "/api/v1/" + nanoleafAuthToken;
-    }
-    else
+    Lock lock(*this);
+    HttpConnection *connection = connections.acquire(nanoleafBaseUrl);
+    if (connection == nullptr)
     {
-        url += "/api/v1";
+        Serial.println("No connection to the Nanoleaf");
+        return false;
     }
 
-    url += endpoint;
+    const String path = buildPath(endpoint, useAuthToken);
+    const int httpResponseCode = writeRequest(*connection, method.c_str(), path, requestBodyLength, writeBody)
+                                     ? readResponse(*connection, method.c_str(), path, requestBodyLength, writeBody)
+                                     : -1;
+    // Only palette writes are paced, small state writes would skew the RTT baseline
+    const bool success = finishRequest(*connection, method.c_str(), useAuthToken, false, httpResponseCode,
+                                       responseBody, responseFilter);
+    connections.release(connection);
+    return success;
+}
 
-    http.begin(client, url);
-    http.addHeader("Content-Type", "application/json");
+String NanoleafApiWrapper::buildPath(const String &endpoint, const bool useAuthToken) const
+{
+    String path = "/api/v1";
+    if (useAuthToken)
+    {
+        path += "/" + nanoleafAuthToken;
+    }
+    path += endpoint;
+    return path;
+}
 
-    int httpResponseCode = -1;
+// Only requests that may arrive twice are repeated, a second POST /new would create another token
+static bool isIdempotent(const char *method)
+{
+    return strcasecmp(method, "GET") == 0 || strcasecmp(method, "PUT") == 0;
+}
 
-    if (method.equalsIgnoreCase("GET"))
+// A kept-alive connection may have been closed by the panels in the meantime,
+// in that case an idempotent request is written once more on a fresh connection
+bool NanoleafApiWrapper::writeRequest(HttpConnection &connection, const char *method, const String &path,
+                                      const size_t requestBodyLength, const BodyWriter &writeBody)
+{
+    if (!isIdempotent(method))
     {
-        httpResponseCode = http.GET();
+        // Cannot be repeated, so it is not risked on a connection the panels may have closed already
+        connection.stop();
     }
-    else if (method.equalsIgnoreCase("POST"))
+    for (int attempt = 0; attempt < 2; attempt++)
     {
-        if (requestBody != nullptr)
+        if (connection.beginRequest(method, path, requestBodyLength) && writeBody(connection.requestBody()))
         {
-            String stringPayload;
-            serializeJson(*requestBody, stringPayload);
-            httpResponseCode = http.POST(stringPayload);
+            return true;
         }
-        else
+        connection.stop();
+        if (!connection.wasReused() || !isIdempotent(method))
         {
-            httpResponseCode = http.POST("");
+            break;
         }
     }
-    else if (method.equalsIgnoreCase("PUT"))
+    return false;
+}
+
+// A closed kept-alive connection often only shows when reading, then an idempotent request is repeated once
+int NanoleafApiWrapper::readResponse(HttpConnection &connection, const char *method, const String &path,
+                                     const size_t requestBodyLength, const BodyWriter &writeBody)
+{
+    int httpResponseCode = connection.endRequest();
+    if (httpResponseCode < 0 && connection.wasReused() && isIdempotent(method))
     {
-        if (requestBody != nullptr)
+        connection.stop();
+        if (connection.beginRequest(method, path, requestBodyLength) && writeBody(connection.requestBody()))
         {
-            String stringPayload;
-            serializeJson(*requestBody, stringPayload);
-            httpResponseCode = http.PUT(stringPayload);
-        }
-        else
-        {
-            httpResponseCode = http.PUT("");
+            // The reconnect is not part of the device's response time
+            pacer.onRequestSent(millis());
+            httpResponseCode = connection.endRequest();
         }
     }
+    if (httpResponseCode < 0)
+    {
+        connection.stop();
+    }
+    return httpResponseCode;
+}
+
+bool NanoleafApiWrapper::finishRequest(HttpConnection &connection, const char *method, const bool useAuthToken,
+                                       const bool paced, const int httpResponseCode, JsonDocument *responseBody,
+                                       const JsonDocument *responseFilter)
+{
+    updateHealth(useAuthToken, httpResponseCode);
 
     if (httpResponseCode > 0)
     {
-        String response = http.getString();
-        if (responseBody != nullptr)
+        // Parsed straight from the socket, the body is never buffered as a whole
+        if (responseBody != nullptr && responseFilter != nullptr)
         {
-            deserializeJson(*responseBody, response);
+            deserializeJson(*responseBody, connection.responseBody(), DeserializationOption::Filter(*responseFilter));
+        }
+        else if (responseBody != nullptr)
+        {
+            deserializeJson(*responseBody, connection.responseBody());
         }
 
-        http.end();
+        connection.endResponse();
+        if (paced)
+        {
+            pacer.onWriteFinished(millis(), httpResponseCode < 500 && httpResponseCode != 429);
+        }
         return true;
     }
+    if (paced)
+    {
+        pacer.onWriteFinished(millis(), false);
+    }
     Serial.print("Error on sending ");
     Serial.print(method);
     Serial.print(": ");
     Serial.println(httpResponseCode);
-    http.end();
     return false;
 }
 
 bool NanoleafApiWrapper::isConnected()
 {
+    Lock lock(*this);
+    if (healthConfirmed && millis() - healthConfirmedAt < HEALTH_TTL)
+    {
+        return true;
+    }
+
+    // The power state is the smallest authenticated resource, the device info at / also
+    // contains the whole layout and effects list
     JsonDocument jsonResponse;
-    if (sendRequest("GET", "/", nullptr, &jsonResponse, true))
+    return sendRequest("GET", "/state/on", nullptr, &jsonResponse, true, &powerStateFilter()) &&
+           healthConfirmed && jsonResponse["value"] != nullptr;
+}
+
+void NanoleafApiWrapper::updateHealth(const bool useAuthToken, const int httpResponseCode)
+{
+    if (httpResponseCode >= 200 && httpResponseCode < 300)
     {
-        if (jsonResponse["serialNo"] != nullptr)
+        // Only an authenticated request proves that the token is still accepted
+        if (useAuthToken)
         {
-            return true;
+            healthConfirmed = true;
+            healthConfirmedAt = millis();
         }
     }
-    return false;
+    else if (httpResponseCode < 0 || (useAuthToken && (httpResponseCode == 401 || httpResponseCode == 403)))
+    {
+        healthConfirmed = false;
+    }
 }
 
 String NanoleafApiWrapper::generateToken()
 {
     JsonDocument jsonResponse;
-    if (sendRequest("POST", "/new", nullptr, &jsonResponse, false))
+    if (sendRequest("POST", "/new", nullptr, &jsonResponse, false, &authTokenFilter()))
     {
         const String strPayload = jsonResponse["auth_token"];
         if (strPayload != nullptr && strPayload != "null")
@@ -130,14 +318,22 @@ bool NanoleafApiWrapper::registerEvents(const std::vector<int> &eventIds)
     String url = "/events?id=" + eventIdString;
     if (WiFi.status() == WL_CONNECTED)
     {
+        closeEventStream();
         String fullUrl = this->nanoleafBaseUrl + "/api/v1/" + this->nanoleafAuthToken + url;
-        httpClient.begin(client, fullUrl);
+        httpClient.begin(eventStreamClient, fullUrl);
+        // Runs from loop(), the same bound as every other Nanoleaf request
+        httpClient.setTimeout(connections.getTimeout());
+#if defined(ESP32)
+        httpClient.setConnectTimeout(connections.getTimeout());
+#endif
         httpClient.addHeader("Content-Type", "text/event-stream");
         int httpResponseCode = httpClient.GET();
         if (httpResponseCode == HTTP_CODE_OK)
         {
             Serial.println("Listening for events...");
             eventClient = httpClient.getStreamPtr();
+            enableKeepAlive();
+            eventParser.reset();
             registeredForEvents = true;
             return true;
         }
@@ -151,25 +347,104 @@ bool NanoleafApiWrapper::registerEvents(const std::vector<int> &eventIds)
     return false;
 }
 
+// The panels only send when something changes, so a silent stream is normal. TCP keepalives
+// make a vanished peer surface as a closed socket instead
+void NanoleafApiWrapper::enableKeepAlive()
+{
+#if defined(ESP8266)
+    eventStreamClient.keepAlive(EVENT_KEEPALIVE_IDLE, EVENT_KEEPALIVE_INTERVAL, EVENT_KEEPALIVE_COUNT);
+#else
+    int enable = 1;
+    int idle = EVENT_KEEPALIVE_IDLE;
+    int interval = EVENT_KEEPALIVE_INTERVAL;
+    int count = EVENT_KEEPALIVE_COUNT;
+    eventStreamClient.setSocketOption(SO_KEEPALIVE, (char *)&enable, sizeof(enable));
+    eventStreamClient.setOption(TCP_KEEPIDLE, &idle);
+    eventStreamClient.setOption(TCP_KEEPINTVL, &interval);
+    eventStreamClient.setOption(TCP_KEEPCNT, &count);
+#endif
+}
+
+void NanoleafApiWrapper::closeEventStream()
+{
+    if (registeredForEvents)
+    {
+        httpClient.end();
+        eventStreamClient.stop();
+    }
+    eventClient = nullptr;
+    registeredForEvents = false;
+}
+
+void NanoleafApiWrapper::closeEvents()
+{
+    Lock lock(*this);
+    closeEventStream();
+}
+
+bool NanoleafApiWrapper::isListeningForEvents() const
+{
+    return registeredForEvents;
+}
+
 void NanoleafApiWrapper::processEvents()
 {
-    if (registeredForEvents && eventClient && eventClient->available())
+    if (!registeredForEvents)
     {
-        String line = eventClient->readStringUntil('\n');
-        String eventId = line.substring(4);
-        if (eventId == "2")
-        {
-            if (this->layoutChangeCallback)
-            {
-                this->layoutChangeCallback();
-            }
-        }
+        return;
+    }
+
+    // Buffered events are still handled after the panels closed the connection
+    if (eventClient && (eventClient->available() > 0 || eventClient->connected()))
+    {
+        eventParser.poll(*eventClient);
+        return;
+    }
+
+    Serial.println("Event stream lost");
+    closeEventStream();
+    healthConfirmed = false;
+    if (eventStreamLostCallback)
+    {
+        eventStreamLostCallback();
     }
 }
 
+void NanoleafApiWrapper::setEventStreamLostCallback(EventStreamLostCallback callback)
+{
+    this->eventStreamLostCallback = callback;
+}
+
+void NanoleafApiWrapper::handleEvent(const SseParser::Event &event)
+{
+    const int eventId = atoi(event.id);
+    if (eventId < (int)EventType::STATE || eventId > (int)EventType::TOUCH)
+    {
+        Serial.printf("Ignoring unknown event %s\n", event.id);
+        return;
+    }
+
+    if (eventId == (int)EventType::LAYOUT)
+    {
+        invalidateLayout();
+    }
+
+    const EventCallback &callback = eventCallbacks[eventId - (int)EventType::STATE];
+    if (callback)
+    {
+        callback(event.data, event.dataLength);
+    }
+}
+
+void NanoleafApiWrapper::setEventCallback(EventType type, EventCallback callback)
+{
+    eventCallbacks[(int)type - (int)EventType::STATE] = callback;
+}
+
 void NanoleafApiWrapper::setLayoutChangeCallback(LayoutChangeCallback callback)
 {
-    this->layoutChangeCallback = callback;
+    setEventCallback(EventType::LAYOUT, [callback](const char *, size_t)
+                     { callback(); });
 }
 
 void NanoleafApiWrapper::setColorCallback(ColorCallback callback)
@@ -183,36 +458,131 @@ bool NanoleafApiWrapper::identify()
 }
 
 std::vector<String> NanoleafApiWrapper::getPanelIds()
+{
+    Lock lock(*this);
+    if (!layoutValid)
+    {
+        refreshLayout();
+    }
+    return panelIds;
+}
+
+bool NanoleafApiWrapper::refreshLayout()
 {
     JsonDocument jsonResponse;
+    Lock lock(*this);
 
-    std::vector<String> panelIds;
+    if (!sendRequest("GET", "/panelLayout/layout", nullptr, &jsonResponse, true, &panelLayoutFilter()) ||
+        jsonResponse["positionData"] == nullptr)
+    {
+        // Keep the last known layout, the next call tries again
+        return false;
+    }
+
+    this->panelIds.clear();
     this->triangleIds.clear();
+    discardEncodedFrames(); // The body contains the triangles
 
-    if (sendRequest("GET", "/panelLayout/layout", nullptr, &jsonResponse, true) &&
-        jsonResponse["positionData"] != nullptr)
+    const size_t arraySize = jsonResponse["positionData"].size();
+    for (size_t i = 0; i < arraySize; i++)
     {
-        const size_t arraySize = jsonResponse["positionData"].size();
-
-        for (size_t i = 0; i < arraySize; i++)
+        String panelId = jsonResponse["positionData"][i]["panelId"].as<String>();
+        String shapeType = jsonResponse["positionData"][i]["shapeType"].as<String>();
+        if (panelId != "0")
         {
-            String panelId = jsonResponse["positionData"][i]["panelId"].as<String>();
-            String shapeType = jsonResponse["positionData"][i]["shapeType"].as<String>();
-            if (panelId != "0")
+            if (shapeType == "9")
             {
-                if (shapeType == "9")
-                {
-                    triangleIds.push_back(panelId);
-                }
-                else
-                {
-                    panelIds.push_back(panelId);
-                }
+                triangleIds.push_back(panelId);
+            }
+            else
+            {
+                panelIds.push_back(panelId);
             }
         }
     }
+    indexPanels();
 
-    return panelIds;
+    layoutValid = true;
+    saveLayout();
+    return true;
+}
+
+void NanoleafApiWrapper::invalidateLayout()
+{
+    Lock lock(*this);
+    layoutValid = false;
+}
+
+bool NanoleafApiWrapper::restoreLayout(const char *path)
+{
+    Lock lock(*this);
+    layoutPath = path;
+
+    JsonDocument snapshot;
+    if (!FileSystemHandler::loadConfigFromFile(path, snapshot, LAYOUT_SNAPSHOT_SIZE))
+    {
+        return false;
+    }
+
+    // A snapshot taken for another device (i.e. another pairing) is ignored. Snapshots of older
+    // firmware with the plain token are ignored too and overwritten with the next layout
+    if (tokenFingerprint() != snapshot["tokenHash"].as<const char *>())
+    {
+        Serial.println("Layout snapshot belongs to another device");
+        return false;
+    }
+
+    panelIds.clear();
+    triangleIds.clear();
+    discardEncodedFrames();
+    for (JsonVariant panelId : snapshot["panelIds"].as<JsonArray>())
+    {
+        panelIds.push_back(panelId.as<String>());
+    }
+    for (JsonVariant triangleId : snapshot["triangleIds"].as<JsonArray>())
+    {
+        triangleIds.push_back(triangleId.as<String>());
+    }
+    indexPanels();
+    layoutValid = true;
+
+    Serial.printf("Restored layout with %u panels and %u triangles\n", (unsigned)panelIds.size(), (unsigned)triangleIds.size());
+    return true;
+}
+
+// FNV-1a of the token, identifies the pairing without a second plain copy of the secret on flash
+String NanoleafApiWrapper::tokenFingerprint() const
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < nanoleafAuthToken.length(); i++)
+    {
+        hash = (hash ^ (uint8_t)nanoleafAuthToken[i]) * 16777619u;
+    }
+    char fingerprint[9];
+    snprintf(fingerprint, sizeof(fingerprint), "%08x", (unsigned)hash);
+    return fingerprint;
+}
+
+void NanoleafApiWrapper::saveLayout()
+{
+    if (layoutPath == nullptr)
+    {
+        return;
+    }
+
+    JsonDocument snapshot;
+    snapshot["tokenHash"] = tokenFingerprint();
+    JsonArray panelArray = snapshot["panelIds"].to<JsonArray>();
+    for (const String &panelId : panelIds)
+    {
+        panelArray.add(panelId);
+    }
+    JsonArray triangleArray = snapshot["triangleIds"].to<JsonArray>();
+    for (const String &triangleId : triangleIds)
+    {
+        triangleArray.add(triangleId);
+    }
+    FileSystemHandler::saveConfigToFile(layoutPath, snapshot);
 }
 
 bool NanoleafApiWrapper::setPower(const bool &state)
@@ -220,6 +590,7 @@ bool NanoleafApiWrapper::setPower(const bool &state)
     JsonDocument jsonPayload;
     jsonPayload["on"] = JsonObject();
     jsonPayload["on"]["value"] = state;
+    externalControlActive = false;
     return sendRequest("PUT", "/state", &jsonPayload, nullptr, true);
 }
 
@@ -250,53 +621,216 @@ void NanoleafApiWrapper::setStaticColor(const int rgb[3])
         return;
     }
 
-    for (int i = 0; i < 3; i++)
+    externalControlActive = false;
+    sendRequest("PUT", "/effects", &payload, nullptr, true);
+}
+
+bool NanoleafApiWrapper::setStaticColors(const ColorFrame &frame)
+{
+    Lock lock(*this);
+    return beginStaticColors(frame) && finishStaticColors();
+}
+
+bool NanoleafApiWrapper::beginStaticColors(const ColorFrame &frame)
+{
+    Lock lock(*this);
+    if (pendingConnection != nullptr)
+    {
+        // The previous write was never finished, its response is skipped with the connection
+        pendingConnection->stop();
+        connections.release(pendingConnection);
+        pendingConnection = nullptr;
+    }
+
+    // A resent or replayed palette keeps the body encoded for it earlier
+    const uint32_t frameHash = frame.contentHash();
+#if defined(ESP32)
+    const int cachedSlot = bodyCache.find(frameHash);
+#endif
+    if (encodedFrameValid && frameHash == encodedFrameHash)
+    {
+        pendingBody = animDataEncoder.data();
+        pendingBodyLength = animDataEncoder.length();
+    }
+#if defined(ESP32)
+    else if (cachedSlot != bodyCache.NONE)
     {
-        sendRequest("PUT", "/effects", &payload, nullptr, true);
-        delay(1000);
-        this->setPower(false);
-        delay(1000);
+        bodyCache.touch(cachedSlot);
+        pendingBody = reinterpret_cast<const char *>(bodyCache.getData(cachedSlot));
+        pendingBodyLength = bodyCache.getLength(cachedSlot);
     }
+#endif
+    else
+    {
+        if (!encodeFrame(frame, frameHash))
+        {
+            return false;
+        }
+        pendingBody = animDataEncoder.data();
+        pendingBodyLength = animDataEncoder.length();
+#if defined(ESP32)
+        if (bodyCache.put(frameHash, reinterpret_cast<const uint8_t *>(pendingBody), pendingBodyLength) ==
+            bodyCache.NONE)
+        {
+            Serial.printf("Effect body of %u bytes exceeds the %u byte body cache\n", (unsigned)pendingBodyLength,
+                          (unsigned)BODY_CACHE_SIZE);
+        }
+#endif
+    }
+
+    if (WiFi.status() != WL_CONNECTED)
+    {
+        Serial.println("WiFi Disconnected");
+        return false;
+    }
+    HttpConnection *connection = connections.acquire(nanoleafBaseUrl);
+    if (connection == nullptr)
+    {
+        Serial.println("No connection to the Nanoleaf");
+        return false;
+    }
+
+    if (this->colorCallback)
+    {
+        this->colorCallback();
+    }
+    externalControlActive = false;
+    pacer.onWriteStarted(millis());
+    pendingPath = buildPath("/effects", true);
+    pendingWritten = writeRequest(*connection, "PUT", pendingPath, pendingBodyLength, effectBodyWriter());
+    // The RTT starts once the request is out, a TCP connect before it is not measured
+    pacer.onRequestSent(millis());
+    pendingConnection = connection;
+    return true;
 }
 
-bool NanoleafApiWrapper::setStaticColors(const JsonObject &doc)
+bool NanoleafApiWrapper::finishStaticColors()
 {
-    String animData = "";
-    const unsigned int tileCount = doc.size() - 1 + this->triangleIds.size();
-    animData += String(tileCount) + " ";
+    Lock lock(*this);
+    HttpConnection *connection = pendingConnection;
+    if (connection == nullptr)
+    {
+        return false;
+    }
+    pendingConnection = nullptr;
+
+    const int httpResponseCode = pendingWritten ? readResponse(*connection, "PUT", pendingPath,
+                                                               pendingBodyLength, effectBodyWriter())
+                                                : -1;
+    const bool success = finishRequest(*connection, "PUT", true, true, httpResponseCode, nullptr, nullptr);
+    connections.release(connection);
+    return success;
+}
 
-    auto fromFriendColor = doc["fromFriendColor"].as<JsonArray>();
-    for (JsonPair kv : doc)
+NanoleafApiWrapper::BodyWriter NanoleafApiWrapper::effectBodyWriter() const
+{
+    return [this](WiFiClient &client)
     {
-        String tileId = kv.key().c_str();
-        if (tileId.equals("fromFriendColor"))
-            continue;
+        return client.write(reinterpret_cast<const uint8_t *>(pendingBody), pendingBodyLength) == pendingBodyLength;
+    };
+}
 
-        auto rgb = kv.value().as<JsonArray>();
+bool NanoleafApiWrapper::encodeFrame(const ColorFrame &frame, const uint32_t frameHash)
+{
+    // Sized for this frame and layout, nothing is dropped
+    if (!animDataEncoder.begin(frame.tileCount + triangleIds.size()))
+    {
+        encodedFrameValid = false;
+        return false;
+    }
 
-        // animData += tileId + " 2 " + String(rgb[0].as<int>()) + " " + String(rgb[1].as<int>()) + " " +
-        //            String(rgb[2].as<int>()) + " 0 " + String(10 * 360) + " 0 0 0 0 360 ";
-        animData += tileId + " 2 " + "0 0 0 0 30 " + String(rgb[0].as<int>()) + " " + String(rgb[1].as<int>()) + " " +
-                    String(rgb[2].as<int>()) + " 0 50 ";
+    for (size_t i = 0; i < frame.tileCount; i++)
+    {
+        const ColorFrame::Tile &tile = frame.tiles[i];
+        animDataEncoder.addTile(tile.id, tile.r, tile.g, tile.b);
     }
 
     for (const auto &triangleId : triangleIds)
     {
-        animData += triangleId + " 2 " + String(fromFriendColor[0].as<int>()) + " " + String(fromFriendColor[1].as<int>()) + " " +
-                    String(fromFriendColor[2].as<int>()) + " 0 " + String(10 * 360) + " 0 0 0 0 360 ";
+        animDataEncoder.addTriangle(triangleId.toInt(), frame.fromFriendColor[0], frame.fromFriendColor[1],
+                                    frame.fromFriendColor[2]);
+    }
+
+    if (!animDataEncoder.finish())
+    {
+        Serial.println("Effect body exceeds the encoder capacity");
+        encodedFrameValid = false;
+        return false;
+    }
+    encodedFrameHash = frameHash;
+    encodedFrameValid = true;
+    return true;
+}
+
+void NanoleafApiWrapper::discardEncodedFrames()
+{
+    encodedFrameValid = false;
+#if defined(ESP32)
+    bodyCache.clear();
+#endif
+}
+
+void NanoleafApiWrapper::indexPanels()
+{
+    panelNumbers.clear();
+    panelNumbers.reserve(panelIds.size());
+    for (const String &id : panelIds)
+    {
+        panelNumbers.push_back(id.toInt());
     }
+    std::sort(panelNumbers.begin(), panelNumbers.end());
+}
 
+bool NanoleafApiWrapper::hasPanel(const uint16_t panelId)
+{
+    Lock lock(*this);
+    return std::binary_search(panelNumbers.begin(), panelNumbers.end(), panelId);
+}
+
+bool NanoleafApiWrapper::hasTriangles()
+{
+    Lock lock(*this);
+    return !triangleIds.empty();
+}
+
+bool NanoleafApiWrapper::enableExternalControl()
+{
     JsonDocument jsonPayload;
     jsonPayload["write"] = JsonObject();
     jsonPayload["write"]["command"] = "display";
-    jsonPayload["write"]["version"] = "2.0";
-    jsonPayload["write"]["animType"] = "custom";
-    jsonPayload["write"]["animData"] = animData;
-    jsonPayload["write"]["loop"] = false;
-    jsonPayload["write"]["palette"] = JsonArray();
-    jsonPayload["write"]["palette"].add(JsonObject());
-    jsonPayload["write"]["palette"][0]["hue"] = 0;
-
-    this->colorCallback();
-    return sendRequest("PUT", "/effects", &jsonPayload, nullptr, true);
+    jsonPayload["write"]["animType"] = "extControl";
+    jsonPayload["write"]["extControlVersion"] = "v2";
+
+    externalControlActive = sendRequest("PUT", "/effects", &jsonPayload, nullptr, true);
+    return externalControlActive;
+}
+
+bool NanoleafApiWrapper::isExternalControlActive() const
+{
+    return externalControlActive;
+}
+
+const String &NanoleafApiWrapper::getBaseUrl() const
+{
+    return nanoleafBaseUrl;
+}
+
+const std::vector<String> &NanoleafApiWrapper::getTriangleIds() const
+{
+    return triangleIds;
+}
+
+unsigned long NanoleafApiWrapper::getWriteDelay() const
+{
+    return pacer.getWriteDelay(millis());
+}
+
+const WritePacer::Stats &NanoleafApiWrapper::getPacerStats() const
+{
+    return pacer.getStats();
+}
+
+HttpConnection::Stats NanoleafApiWrapper::getConnectionStats() const
+{
+    return connections.getStats();
 }
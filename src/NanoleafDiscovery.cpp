@@ -0,0 +1,237 @@
+#include "NanoleafDiscovery.h"
+
+bool NanoleafDiscovery::begin(const char *hostname)
+{
+    if (!started)
+    {
+        started = MDNS.begin(hostname);
+        if (started)
+        {
+            Serial.println("MDNS wurde gestartet.");
+        }
+        else
+        {
+            Serial.println("Fehler beim Starten von MNDS.");
+        }
+    }
+    return started;
+}
+
+bool NanoleafDiscovery::startQuery()
+{
+    if (!started)
+    {
+        return false;
+    }
+    if (queryRunning)
+    {
+        return true;
+    }
+
+#if defined(ESP8266)
+    // Answers arrive in parts (port, TXT, address), a device is added once all of them are known
+    query = MDNS.installServiceQuery(
+        "nanoleafapi", "tcp",
+        [this](MDNSResponder::MDNSServiceInfo serviceInfo, MDNSResponder::AnswerType, bool setContent)
+        {
+            if (!setContent || !serviceInfo.IP4AddressAvailable() || !serviceInfo.hostPortAvailable() ||
+                !serviceInfo.txtAvailable())
+            {
+                return;
+            }
+            std::vector<IPAddress> addresses = serviceInfo.IP4Adresses();
+            const char *id = serviceInfo.value("id");
+            if (!addresses.empty())
+            {
+                addDevice(id != nullptr ? id : "", addresses[0], serviceInfo.hostPort());
+            }
+        });
+#else
+    // Arduino-ESP32 2.x ships ESP-IDF 4.4, its variant has no notifier argument, answers are polled in loop()
+    query = mdns_query_async_new(nullptr, "_nanoleafapi", "_tcp", MDNS_TYPE_PTR, QUERY_DURATION, MAX_DEVICES * 2);
+#endif
+    if (query == nullptr)
+    {
+        Serial.println("Failed to start the Nanoleaf mDNS query");
+        return false;
+    }
+
+    queryRunning = true;
+    queryStartedAt = millis();
+    return true;
+}
+
+bool NanoleafDiscovery::isQueryRunning() const
+{
+    return queryRunning;
+}
+
+void NanoleafDiscovery::loop()
+{
+    if (!started)
+    {
+        return;
+    }
+
+#if defined(ESP8266)
+    MDNS.update();
+    if (queryRunning && millis() - queryStartedAt >= QUERY_DURATION)
+    {
+        MDNS.removeServiceQuery(query);
+        finishQuery();
+    }
+#else
+    mdns_result_t *results = nullptr;
+    // Does not wait, returns true once the query has run for QUERY_DURATION
+    if (queryRunning && mdns_query_async_get_results(query, 0, &results))
+    {
+        for (const mdns_result_t *result = results; result != nullptr; result = result->next)
+        {
+            const char *id = "";
+            for (size_t i = 0; i < result->txt_count; i++)
+            {
+                if (strcmp(result->txt[i].key, "id") == 0 && result->txt[i].value != nullptr)
+                {
+                    id = result->txt[i].value;
+                }
+            }
+            for (const mdns_ip_addr_t *address = result->addr; address != nullptr; address = address->next)
+            {
+                if (address->addr.type == ESP_IPADDR_TYPE_V4)
+                {
+                    addDevice(id, IPAddress(address->addr.u_addr.ip4.addr), result->port);
+                    break;
+                }
+            }
+        }
+        mdns_query_results_free(results);
+        mdns_query_async_delete(query);
+        finishQuery();
+    }
+#endif
+}
+
+void NanoleafDiscovery::finishQuery()
+{
+    query = nullptr;
+    queryRunning = false;
+    Serial.printf("Nanoleaf discovery finished, %u device(s) known\n", (unsigned)getDeviceCount());
+    if (queryFinishedCallback)
+    {
+        queryFinishedCallback();
+    }
+}
+
+void NanoleafDiscovery::setQueryFinishedCallback(QueryFinishedCallback callback)
+{
+    this->queryFinishedCallback = callback;
+}
+
+void NanoleafDiscovery::addDevice(const char *id, const IPAddress &ip, const uint16_t port)
+{
+    // Update the known entry of this device, otherwise take a free or the oldest entry
+    Device *entry = nullptr;
+    for (Device &device : devices)
+    {
+        if (device.seenAt != 0 && strcmp(device.id, id) == 0)
+        {
+            entry = &device;
+            break;
+        }
+        if (entry == nullptr || device.seenAt == 0 ||
+            (entry->seenAt != 0 && static_cast<long>(device.seenAt - entry->seenAt) < 0))
+        {
+            entry = &device;
+        }
+    }
+
+    if (entry->seenAt == 0 || strcmp(entry->id, id) != 0)
+    {
+        Serial.printf("Nanoleaf %s gefunden: %s:%u\n", id, ip.toString().c_str(), port);
+    }
+    strncpy(entry->id, id, MAX_ID_LENGTH);
+    entry->id[MAX_ID_LENGTH] = '\0';
+    entry->ip = ip;
+    entry->port = port;
+    entry->seenAt = millis();
+    if (entry->seenAt == 0)
+    {
+        entry->seenAt = 1; // 0 marks a free entry
+    }
+}
+
+bool NanoleafDiscovery::isFresh(const Device &device) const
+{
+    return device.seenAt != 0 && millis() - device.seenAt < CACHE_TTL;
+}
+
+const NanoleafDiscovery::Device *NanoleafDiscovery::select(const char *deviceId, const char *baseUrl) const
+{
+    const Device *first = nullptr;
+    for (const Device &device : devices)
+    {
+        if (!isFresh(device))
+        {
+            continue;
+        }
+        if (deviceId != nullptr && deviceId[0] != '\0')
+        {
+            if (strcmp(device.id, deviceId) == 0)
+            {
+                return &device;
+            }
+            continue;
+        }
+
+        // Without an id yet, the device that was configured before is the one to keep
+        if (baseUrl != nullptr && baseUrl[0] != '\0')
+        {
+            char url[64];
+            buildBaseUrl(device, url, sizeof(url));
+            if (strcmp(url, baseUrl) == 0)
+            {
+                return &device;
+            }
+        }
+        if (first == nullptr)
+        {
+            first = &device;
+        }
+    }
+
+    if (first != nullptr && getDeviceCount() > 1)
+    {
+        Serial.printf("%u Nanoleafs found, using %s\n", (unsigned)getDeviceCount(), first->id);
+    }
+    return first;
+}
+
+size_t NanoleafDiscovery::getDeviceCount() const
+{
+    size_t count = 0;
+    for (const Device &device : devices)
+    {
+        if (isFresh(device))
+        {
+            count++;
+        }
+    }
+    return count;
+}
+
+const NanoleafDiscovery::Device *NanoleafDiscovery::getDevice(size_t index) const
+{
+    for (const Device &device : devices)
+    {
+        if (isFresh(device) && index-- == 0)
+        {
+            return &device;
+        }
+    }
+    return nullptr;
+}
+
+void NanoleafDiscovery::buildBaseUrl(const Device &device, char *url, const size_t size)
+{
+    snprintf(url, size, "http://%s:%u", device.ip.toString().c_str(), device.port);
+}
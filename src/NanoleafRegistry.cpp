@@ -0,0 +1,192 @@
+#include "NanoleafRegistry.h"
+
+NanoleafRegistry::NanoleafRegistry(NanoleafApiWrapper &primary, HttpConnectionManager &connections)
+    : connections(connections)
+{
+    devices[0] = &primary;
+}
+
+NanoleafApiWrapper *NanoleafRegistry::addDevice()
+{
+    if (count >= MAX_DEVICES)
+    {
+        Serial.printf("At most %u Nanoleafs are supported\n", (unsigned)MAX_DEVICES);
+        return nullptr;
+    }
+    if (!frames)
+    {
+        frames.reset(new ColorFrame[MAX_DEVICES]);
+    }
+    additionalDevices[count - 1].reset(new NanoleafApiWrapper(connections));
+    devices[count] = additionalDevices[count - 1].get();
+    return devices[count++];
+}
+
+size_t NanoleafRegistry::size() const
+{
+    return count;
+}
+
+NanoleafApiWrapper &NanoleafRegistry::get(const size_t index)
+{
+    return *devices[index];
+}
+
+bool NanoleafRegistry::setStaticColors(const ColorFrame &frame)
+{
+    if (count == 1)
+    {
+        return writeDevice(0, frame);
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        frames[i].tileCount = 0;
+        memcpy(frames[i].fromFriendColor, frame.fromFriendColor, sizeof(frame.fromFriendColor));
+    }
+    for (size_t t = 0; t < frame.tileCount; t++)
+    {
+        size_t owner = 0;
+        for (size_t i = 1; i < count; i++)
+        {
+            if (devices[i]->hasPanel(frame.tiles[t].id))
+            {
+                owner = i;
+                break;
+            }
+        }
+        frames[owner].tiles[frames[owner].tileCount++] = frame.tiles[t];
+    }
+
+    // Held until every response is read, the connections are not used by anyone else meanwhile
+    NanoleafApiWrapper::Lock locks[MAX_DEVICES];
+    bool started[MAX_DEVICES] = {};
+    bool success = true;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (frames[i].tileCount == 0 && !devices[i]->hasTriangles())
+        {
+            continue;
+        }
+        locks[i].acquire(*devices[i]);
+        if (!healthy[i])
+        {
+            // Skipped until isConnected() sees it again instead of stalling every palette
+            continue;
+        }
+        if (streaming[i])
+        {
+            // A datagram has no response to wait for
+            if (!writeDevice(i, frames[i]))
+            {
+                Serial.printf("Streaming to Nanoleaf %s failed\n", devices[i]->getBaseUrl().c_str());
+                success = false;
+            }
+            continue;
+        }
+        started[i] = devices[i]->beginStaticColors(frames[i]);
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        if (started[i] && !devices[i]->finishStaticColors())
+        {
+            Serial.printf("Writing to Nanoleaf %s failed\n", devices[i]->getBaseUrl().c_str());
+            success = false;
+        }
+    }
+    return success;
+}
+
+bool NanoleafRegistry::writeDevice(const size_t index, const ColorFrame &frame)
+{
+    NanoleafApiWrapper::Lock lock(*devices[index]);
+    if (streaming[index])
+    {
+        return streamingEngines[index]->setStaticColors(frame);
+    }
+    return devices[index]->setStaticColors(frame);
+}
+
+bool NanoleafRegistry::beginStreaming(UDP &udp, NanoleafApiWrapper::ColorCallback colorCallback)
+{
+    bool success = true;
+    for (size_t i = 0; i < count; i++)
+    {
+        // The output task only looks at the engine while holding the same lock
+        NanoleafApiWrapper::Lock lock(*devices[i]);
+        if (!streamingEngines[i])
+        {
+            streamingEngines[i].reset(new NanoleafStreamingEngine(*devices[i], udp));
+            streamingEngines[i]->setColorCallback(colorCallback);
+        }
+        streaming[i] = streamingEngines[i]->begin();
+        if (!streaming[i])
+        {
+            Serial.printf("Streaming to Nanoleaf %s not started, using HTTP\n", devices[i]->getBaseUrl().c_str());
+            success = false;
+        }
+    }
+    return success;
+}
+
+bool NanoleafRegistry::isConnected()
+{
+    for (size_t i = 1; i < count; i++)
+    {
+        const bool connected = devices[i]->isConnected();
+        NanoleafApiWrapper::Lock lock(*devices[i]);
+        if (connected == healthy[i])
+        {
+            continue;
+        }
+        healthy[i] = connected;
+        if (!connected)
+        {
+            Serial.printf("Lost connection to Nanoleaf %s, skipping it\n", devices[i]->getBaseUrl().c_str());
+            continue;
+        }
+        Serial.printf("Nanoleaf %s is back\n", devices[i]->getBaseUrl().c_str());
+        if (streamingEngines[i])
+        {
+            // It dropped extControl if it restarted meanwhile
+            streaming[i] = streamingEngines[i]->begin();
+        }
+    }
+    return devices[0]->isConnected();
+}
+
+unsigned long NanoleafRegistry::getWriteDelay() const
+{
+    unsigned long writeDelay = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        const unsigned long deviceDelay = devices[i]->getWriteDelay();
+        if (deviceDelay > writeDelay)
+        {
+            writeDelay = deviceDelay;
+        }
+    }
+    return writeDelay;
+}
+
+std::vector<String> NanoleafRegistry::getPanelIds()
+{
+    std::vector<String> panelIds = devices[0]->getPanelIds();
+    for (size_t i = 1; i < count; i++)
+    {
+        for (const String &panelId : devices[i]->getPanelIds())
+        {
+            panelIds.push_back(panelId);
+        }
+    }
+    return panelIds;
+}
+
+void NanoleafRegistry::processEvents()
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        devices[i]->processEvents();
+    }
+}
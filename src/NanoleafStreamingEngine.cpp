@@ -0,0 +1,128 @@
+#include "NanoleafStreamingEngine.h"
+
+NanoleafStreamingEngine::NanoleafStreamingEngine(NanoleafApiWrapper &nanoleaf, UDP &udp)
+    : nanoleaf(nanoleaf), udp(udp)
+{
+}
+
+bool NanoleafStreamingEngine::begin()
+{
+    // Base URL has the form http://<ip>:<port>
+    const String &baseUrl = nanoleaf.getBaseUrl();
+    int hostStart = baseUrl.indexOf("://");
+    hostStart = hostStart < 0 ? 0 : hostStart + 3;
+    int hostEnd = baseUrl.indexOf(':', hostStart);
+    if (hostEnd < 0)
+    {
+        hostEnd = baseUrl.length();
+    }
+
+    IPAddress address;
+    if (!address.fromString(baseUrl.substring(hostStart, hostEnd)))
+    {
+        Serial.println("Streaming: Nanoleaf base URL does not contain an IP address");
+        hostResolved = false;
+        return false;
+    }
+    return begin(address, DEFAULT_PORT);
+}
+
+bool NanoleafStreamingEngine::begin(const IPAddress &host, const uint16_t port)
+{
+    this->host = host;
+    this->port = port;
+    hostResolved = true;
+    return ensureStreaming();
+}
+
+void NanoleafStreamingEngine::setColorCallback(NanoleafApiWrapper::ColorCallback callback)
+{
+    this->colorCallback = callback;
+}
+
+bool NanoleafStreamingEngine::ensureStreaming()
+{
+    if (nanoleaf.isExternalControlActive())
+    {
+        return true;
+    }
+    if (!nanoleaf.enableExternalControl())
+    {
+        Serial.println("Streaming: Failed to enable extControl");
+        return false;
+    }
+    return true;
+}
+
+bool NanoleafStreamingEngine::appendPanel(const uint16_t panelId, const uint8_t r, const uint8_t g, const uint8_t b)
+{
+    if (panelCount >= MAX_PANELS)
+    {
+        return false;
+    }
+
+    // v2 panel record: panelId (2), R, G, B, W, transitionTime (2), all big endian
+    frame[frameLength++] = panelId >> 8;
+    frame[frameLength++] = panelId & 0xFF;
+    frame[frameLength++] = r;
+    frame[frameLength++] = g;
+    frame[frameLength++] = b;
+    frame[frameLength++] = 0;
+    frame[frameLength++] = TRANSITION_TIME >> 8;
+    frame[frameLength++] = TRANSITION_TIME & 0xFF;
+    panelCount++;
+    return true;
+}
+
+bool NanoleafStreamingEngine::setStaticColors(const ColorFrame &colors)
+{
+    if (!hostResolved && !begin())
+    {
+        return false;
+    }
+    if (!ensureStreaming())
+    {
+        return false;
+    }
+
+    // Header holds the panel count, filled in once all panels are appended
+    frameLength = 2;
+    panelCount = 0;
+
+    for (size_t i = 0; i < colors.tileCount; i++)
+    {
+        const ColorFrame::Tile &tile = colors.tiles[i];
+        if (!appendPanel(tile.id, tile.r, tile.g, tile.b))
+        {
+            Serial.printf("Streaming: Skipping panel %u\n", tile.id);
+        }
+    }
+
+    {
+        NanoleafApiWrapper::Lock lock(nanoleaf);
+        for (const auto &triangleId : nanoleaf.getTriangleIds())
+        {
+            if (!appendPanel(triangleId.toInt(), colors.fromFriendColor[0], colors.fromFriendColor[1],
+                             colors.fromFriendColor[2]))
+            {
+                Serial.printf("Streaming: Skipping panel %s\n", triangleId.c_str());
+            }
+        }
+    }
+
+    frame[0] = panelCount >> 8;
+    frame[1] = panelCount & 0xFF;
+
+    if (this->colorCallback)
+    {
+        this->colorCallback();
+    }
+
+    if (!udp.beginPacket(host, port))
+    {
+        Serial.println("Streaming: Failed to open UDP packet");
+        return false;
+    }
+    udp.write(frame, frameLength);
+    return udp.endPacket();
+}
@@ -0,0 +1,244 @@
+#include "PaletteCache.h"
+#include "FileSystemHandler.h"
+
+static const char HEX_DIGITS[] = "0123456789abcdef";
+
+static int hexValue(const char c)
+{
+    if (c >= '0' && c <= '9')
+    {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f')
+    {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F')
+    {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+PaletteCache::Lock::Lock(PaletteCache &cache)
+    : cache(cache)
+{
+#if defined(ESP32)
+    xSemaphoreTake(cache.mutex, portMAX_DELAY);
+#endif
+}
+
+PaletteCache::Lock::~Lock()
+{
+#if defined(ESP32)
+    xSemaphoreGive(cache.mutex);
+#endif
+}
+
+PaletteCache::PaletteCache()
+{
+#if defined(ESP32)
+    mutex = xSemaphoreCreateMutex();
+#endif
+}
+
+PaletteCache::~PaletteCache()
+{
+#if defined(ESP32)
+    vSemaphoreDelete(mutex);
+#endif
+}
+
+void PaletteCache::put(const ColorFrame &frame)
+{
+    uint8_t packed[ColorFrame::MAX_PACKED_SIZE];
+    const size_t length = frame.encode(packed);
+    const uint32_t contentHash = frame.contentHash();
+    const bool hasId = frame.paletteId[0] != '\0';
+
+    Lock lock(*this);
+    int slot = palettes.find(contentHash);
+    if (slot != palettes.NONE)
+    {
+        // Same palette again, at most the backend assigned it an id now
+        palettes.touch(slot);
+        if (hasId && strcmp(ids[slot], frame.paletteId) != 0)
+        {
+            const int previous = findSlot(frame.paletteId);
+            if (previous != palettes.NONE)
+            {
+                ids[previous][0] = '\0';
+            }
+            strcpy(ids[slot], frame.paletteId);
+            dirty = true;
+        }
+        return;
+    }
+
+    // An id that now stands for different colors is replaced
+    const int previous = hasId ? findSlot(frame.paletteId) : palettes.NONE;
+    if (previous != palettes.NONE)
+    {
+        palettes.remove(previous);
+    }
+    slot = palettes.put(contentHash, packed, length);
+    if (slot == palettes.NONE)
+    {
+        return;
+    }
+    strcpy(ids[slot], frame.paletteId);
+    stats.stored++;
+    dirty = true;
+}
+
+bool PaletteCache::findById(const char *paletteId, ColorFrame &frame)
+{
+    Lock lock(*this);
+    return load(findSlot(paletteId), frame);
+}
+
+bool PaletteCache::findByHash(const uint32_t contentHash, ColorFrame &frame)
+{
+    Lock lock(*this);
+    return load(palettes.find(contentHash), frame);
+}
+
+size_t PaletteCache::size()
+{
+    Lock lock(*this);
+    return palettes.size();
+}
+
+bool PaletteCache::isDirty()
+{
+    Lock lock(*this);
+    return dirty;
+}
+
+PaletteCache::Stats PaletteCache::getStats()
+{
+    Lock lock(*this);
+    stats.evicted = palettes.getEvictions();
+    return stats;
+}
+
+int PaletteCache::findSlot(const char *paletteId)
+{
+    if (paletteId == nullptr || paletteId[0] == '\0')
+    {
+        return palettes.NONE;
+    }
+    for (size_t i = 0; i < MAX_ENTRIES; i++)
+    {
+        if (palettes.isUsed(i) && strcmp(ids[i], paletteId) == 0)
+        {
+            return i;
+        }
+    }
+    return palettes.NONE;
+}
+
+bool PaletteCache::load(const int slot, ColorFrame &frame)
+{
+    if (slot == palettes.NONE)
+    {
+        stats.misses++;
+        return false;
+    }
+    stats.hits++;
+    palettes.touch(slot);
+    frame.decode(palettes.getData(slot), palettes.getLength(slot));
+    strcpy(frame.paletteId, ids[slot]);
+    return true;
+}
+
+bool PaletteCache::save(const char *path)
+{
+    JsonDocument jsonDoc;
+    JsonArray entries = jsonDoc["palettes"].to<JsonArray>();
+    char hex[2 * ColorFrame::MAX_PACKED_SIZE + 1];
+
+    {
+        Lock lock(*this);
+        // Least recently used first, so restore() keeps the eviction order
+        bool saved[MAX_ENTRIES] = {};
+        for (size_t n = palettes.size(); n > 0; n--)
+        {
+            int next = palettes.NONE;
+            for (size_t i = 0; i < MAX_ENTRIES; i++)
+            {
+                if (palettes.isUsed(i) && !saved[i] &&
+                    (next == palettes.NONE ||
+                     static_cast<int32_t>(palettes.getLastUsed(i) - palettes.getLastUsed(next)) < 0))
+                {
+                    next = i;
+                }
+            }
+            saved[next] = true;
+
+            const uint8_t *packed = palettes.getData(next);
+            const size_t length = palettes.getLength(next);
+            for (size_t i = 0; i < length; i++)
+            {
+                hex[2 * i] = HEX_DIGITS[packed[i] >> 4];
+                hex[2 * i + 1] = HEX_DIGITS[packed[i] & 0x0F];
+            }
+            hex[2 * length] = '\0';
+
+            JsonObject palette = entries.add<JsonObject>();
+            palette["id"] = ids[next];
+            palette["data"] = hex;
+        }
+        // Palettes displayed while the file is written mark the cache dirty again
+        dirty = false;
+    }
+
+    if (!FileSystemHandler::saveConfigToFile(path, jsonDoc))
+    {
+        Lock lock(*this);
+        dirty = true;
+        return false;
+    }
+    return true;
+}
+
+bool PaletteCache::restore(const char *path)
+{
+    JsonDocument jsonDoc;
+    if (!FileSystemHandler::loadConfigFromFile(path, jsonDoc, JSON_SIZE))
+    {
+        return false;
+    }
+
+    uint8_t packed[ColorFrame::MAX_PACKED_SIZE];
+    ColorFrame frame;
+    for (JsonObject palette : jsonDoc["palettes"].as<JsonArray>())
+    {
+        const char *hex = palette["data"] | "";
+        const size_t length = strlen(hex) / 2;
+        if (length > sizeof(packed))
+        {
+            continue;
+        }
+        bool valid = true;
+        for (size_t i = 0; i < length && valid; i++)
+        {
+            const int high = hexValue(hex[2 * i]);
+            const int low = hexValue(hex[2 * i + 1]);
+            valid = high >= 0 && low >= 0;
+            packed[i] = (high << 4) | low;
+        }
+        const char *id = palette["id"] | "";
+        if (valid && frame.decode(packed, length) && strlen(id) <= ColorFrame::MAX_PALETTE_ID_LENGTH)
+        {
+            strcpy(frame.paletteId, id);
+            put(frame);
+        }
+    }
+
+    // Restored entries are already on flash
+    Lock lock(*this);
+    dirty = false;
+    Serial.printf("Restored %u cached palettes\n", (unsigned)palettes.size());
+    return true;
+}
@@ -0,0 +1,235 @@
+#include "SseParser.h"
+
+static const size_t RING_MASK = SseParser::RING_SIZE - 1;
+
+void SseParser::setEventCallback(EventCallback callback)
+{
+    this->eventCallback = callback;
+}
+
+size_t SseParser::poll(Stream &stream)
+{
+    size_t events = 0;
+    while (events < MAX_EVENTS_PER_POLL)
+    {
+        if (head == tail && fill(stream) == 0)
+        {
+            break;
+        }
+        const uint8_t c = ring[tail & RING_MASK];
+        tail++;
+        if (parse(c))
+        {
+            events++;
+        }
+    }
+    // Keep draining the socket even if the event budget is used up
+    fill(stream);
+    return events;
+}
+
+size_t SseParser::fill(Stream &stream)
+{
+    size_t total = 0;
+    // At most two contiguous segments when the free space wraps around
+    for (int segment = 0; segment < 2; segment++)
+    {
+        const size_t free = RING_SIZE - (head - tail);
+        const size_t offset = head & RING_MASK;
+        size_t length = RING_SIZE - offset < free ? RING_SIZE - offset : free;
+        const int available = stream.available();
+        if (available <= 0 || length == 0)
+        {
+            break;
+        }
+        if ((size_t)available < length)
+        {
+            length = available;
+        }
+        // Never blocks, the bytes are already available
+        const size_t read = stream.readBytes((char *)ring + offset, length);
+        head += read;
+        total += read;
+        if (read < length)
+        {
+            break;
+        }
+    }
+    return total;
+}
+
+void SseParser::reset()
+{
+    head = tail = 0;
+    state = FIELD;
+    target = NONE;
+    fieldLength = 0;
+    lastWasCarriageReturn = false;
+    id[0] = '\0';
+    idLength = 0;
+    dataLength = 0;
+    dataOverflow = false;
+}
+
+uint32_t SseParser::getDroppedEvents() const
+{
+    return droppedEvents;
+}
+
+// Returns true if the byte completed an event that was dispatched
+bool SseParser::parse(const uint8_t c)
+{
+    // Lines end with CR, LF or CRLF
+    if (c == '\n' && lastWasCarriageReturn)
+    {
+        lastWasCarriageReturn = false;
+        return false;
+    }
+    lastWasCarriageReturn = c == '\r';
+    if (c == '\r' || c == '\n')
+    {
+        return endLine();
+    }
+
+    switch (state)
+    {
+    case FIELD:
+        if (c == ':')
+        {
+            // A line starting with a colon is a comment (keepalive)
+            if (fieldLength == 0)
+            {
+                state = IGNORE;
+            }
+            else
+            {
+                selectField();
+                state = VALUE_START;
+            }
+        }
+        else if (fieldLength < MAX_FIELD_LENGTH)
+        {
+            field[fieldLength++] = c;
+        }
+        else
+        {
+            state = IGNORE;
+        }
+        break;
+    case VALUE_START:
+        state = VALUE;
+        // A single space after the colon is not part of the value
+        if (c != ' ')
+        {
+            appendValue(c);
+        }
+        break;
+    case VALUE:
+        appendValue(c);
+        break;
+    case IGNORE:
+        break;
+    }
+    return false;
+}
+
+void SseParser::selectField()
+{
+    if (fieldLength == 2 && memcmp(field, "id", 2) == 0)
+    {
+        target = ID;
+        idLength = 0;
+    }
+    else if (fieldLength == 4 && memcmp(field, "data", 4) == 0)
+    {
+        target = DATA;
+    }
+    else
+    {
+        target = NONE;
+    }
+}
+
+void SseParser::appendValue(const char c)
+{
+    if (target == ID)
+    {
+        if (idLength < MAX_ID_LENGTH)
+        {
+            id[idLength++] = c;
+        }
+    }
+    else if (target == DATA)
+    {
+        if (dataLength < MAX_DATA_LENGTH)
+        {
+            data[dataLength++] = c;
+        }
+        else
+        {
+            dataOverflow = true;
+        }
+    }
+}
+
+bool SseParser::endLine()
+{
+    bool dispatched = false;
+    if (state == FIELD && fieldLength == 0)
+    {
+        // An empty line completes the event
+        dispatched = dispatch();
+    }
+    else
+    {
+        if (state == FIELD)
+        {
+            // A field name without a colon has an empty value
+            selectField();
+        }
+        if (target == ID)
+        {
+            id[idLength] = '\0';
+        }
+        else if (target == DATA)
+        {
+            // Multiple data lines are joined with a line feed
+            appendValue('\n');
+        }
+    }
+
+    state = FIELD;
+    target = NONE;
+    fieldLength = 0;
+    return dispatched;
+}
+
+bool SseParser::dispatch()
+{
+    if (dataLength == 0 && !dataOverflow)
+    {
+        return false;
+    }
+
+    bool dispatched = false;
+    if (dataOverflow)
+    {
+        droppedEvents++;
+        Serial.printf("Dropped event %s, data exceeds %u bytes\n", id, (unsigned)MAX_DATA_LENGTH);
+    }
+    else
+    {
+        // Strip the line feed appended after the last data line
+        dataLength--;
+        data[dataLength] = '\0';
+        if (eventCallback)
+        {
+            eventCallback(Event{id, data, dataLength});
+            dispatched = true;
+        }
+    }
+
+    dataLength = 0;
+    dataOverflow = false;
+    return dispatched;
+}
@@ -0,0 +1,153 @@
+#include "TopicRouter.h"
+
+uint32_t TopicRouter::hash(const char *text, const size_t length)
+{
+    // FNV-1a
+    uint32_t value = 2166136261u;
+    for (size_t i = 0; i < length; i++)
+    {
+        value ^= static_cast<uint8_t>(text[i]);
+        value *= 16777619u;
+    }
+    return value;
+}
+
+bool TopicRouter::add(const String &filter, TopicAdapter *adapter)
+{
+    Route route;
+    route.filter = filter;
+    route.adapter = adapter;
+    route.segmentCount = 0;
+
+    const char *text = route.filter.c_str();
+    const size_t length = route.filter.length();
+    size_t start = 0;
+    while (true)
+    {
+        size_t end = start;
+        while (end < length && text[end] != '/')
+        {
+            end++;
+        }
+
+        if (route.segmentCount == MAX_SEGMENTS)
+        {
+            Serial.printf("Topic filter %s has too many levels\n", text);
+            return false;
+        }
+
+        Segment &segment = route.segments[route.segmentCount++];
+        segment.offset = start;
+        segment.length = end - start;
+        segment.hash = hash(text + start, segment.length);
+        segment.type = LITERAL;
+
+        if (segment.length == 1 && text[start] == '+')
+        {
+            segment.type = SINGLE_LEVEL;
+        }
+        else if (segment.length == 1 && text[start] == '#')
+        {
+            if (end != length)
+            {
+                Serial.printf("Invalid topic filter %s, '#' must be the last level\n", text);
+                return false;
+            }
+            segment.type = MULTI_LEVEL;
+        }
+
+        if (end >= length)
+        {
+            break;
+        }
+        start = end + 1;
+    }
+
+    routes.push_back(route);
+    return true;
+}
+
+bool TopicRouter::matches(const Route &route, const char *topic, const Segment *segments, const size_t segmentCount)
+{
+    const char *filter = route.filter.c_str();
+
+    for (size_t i = 0; i < route.segmentCount; i++)
+    {
+        const Segment &expected = route.segments[i];
+
+        if (expected.type == MULTI_LEVEL)
+        {
+            // Also matches the parent level itself, e.g. a/# matches a
+            return i > 0 || topic[0] != '$';
+        }
+        if (i >= segmentCount)
+        {
+            return false;
+        }
+        if (expected.type == SINGLE_LEVEL)
+        {
+            if (i == 0 && topic[0] == '$')
+            {
+                return false;
+            }
+            continue;
+        }
+
+        const Segment &received = segments[i];
+        if (received.hash != expected.hash || received.length != expected.length ||
+            memcmp(topic + received.offset, filter + expected.offset, expected.length) != 0)
+        {
+            return false;
+        }
+    }
+
+    return route.segmentCount == segmentCount;
+}
+
+TopicAdapter *TopicRouter::route(const char *topic) const
+{
+    // Split and hash the received topic once for all routes
+    Segment segments[MAX_SEGMENTS + 1];
+    size_t segmentCount = 0;
+    size_t start = 0;
+    while (segmentCount <= MAX_SEGMENTS)
+    {
+        size_t end = start;
+        while (topic[end] != '\0' && topic[end] != '/')
+        {
+            end++;
+        }
+
+        Segment &segment = segments[segmentCount++];
+        segment.offset = start;
+        segment.length = end - start;
+        segment.hash = hash(topic + start, segment.length);
+        segment.type = LITERAL;
+
+        if (topic[end] == '\0')
+        {
+            break;
+        }
+        start = end + 1;
+    }
+
+    // Deeper topics can only match a '#' filter, segmentCount then exceeds every literal route
+    for (const Route &route : routes)
+    {
+        if (matches(route, topic, segments, segmentCount))
+        {
+            return route.adapter;
+        }
+    }
+    return nullptr;
+}
+
+size_t TopicRouter::size() const
+{
+    return routes.size();
+}
+
+const String &TopicRouter::getFilter(const size_t index) const
+{
+    return routes[index].filter;
+}
@@ -0,0 +1,79 @@
+#include "WritePacer.h"
+
+unsigned long WritePacer::getWriteDelay(const unsigned long now) const
+{
+    if (!written)
+    {
+        return 0;
+    }
+    const unsigned long elapsed = now - lastWriteStartedAt;
+    return elapsed >= stats.interval ? 0 : stats.interval - elapsed;
+}
+
+void WritePacer::onWriteStarted(const unsigned long now)
+{
+    lastWriteStartedAt = now;
+    requestSentAt = now;
+    written = true;
+}
+
+void WritePacer::onRequestSent(const unsigned long now)
+{
+    requestSentAt = now;
+}
+
+void WritePacer::backOff()
+{
+    stats.backoffs++;
+    stats.interval = stats.interval * 2 > MAX_INTERVAL ? MAX_INTERVAL : stats.interval * 2;
+}
+
+void WritePacer::onWriteFinished(const unsigned long now, const bool success)
+{
+    stats.writes++;
+    const unsigned long rtt = now - requestSentAt;
+
+    if (!success)
+    {
+        stats.failures++;
+        backOff();
+        return;
+    }
+
+    // Exponentially weighted average with a weight of 1/8, like TCP's SRTT
+    stats.smoothedRtt = stats.smoothedRtt == 0 ? rtt : (stats.smoothedRtt * 7 + rtt) / 8;
+    if (stats.minRtt == 0 || rtt < stats.minRtt)
+    {
+        stats.minRtt = rtt;
+    }
+    if (windowMinRtt == 0 || rtt < windowMinRtt)
+    {
+        windowMinRtt = rtt;
+    }
+    if (++windowWrites >= MIN_RTT_WINDOW)
+    {
+        // The previous window ages out, the minimum follows the device if it got slower
+        stats.minRtt = windowMinRtt;
+        windowMinRtt = 0;
+        windowWrites = 0;
+    }
+
+    // A write that takes much longer than the fastest one means the device is queueing
+    if (rtt > stats.minRtt * 2 + RTT_SLACK)
+    {
+        backOff();
+    }
+    else if (stats.interval > MIN_INTERVAL + INTERVAL_STEP)
+    {
+        stats.interval -= INTERVAL_STEP;
+    }
+    else
+    {
+        stats.interval = MIN_INTERVAL;
+    }
+}
+
+const WritePacer::Stats &WritePacer::getStats() const
+{
+    return stats;
+}